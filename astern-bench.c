@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame-scheduler.h"
+#include "render-utils.h"
+#include "renderer_astern.h"
+
+/*
+ * Benchmark for the A* search in the cube.
+ *
+ * Every heuristic searches the same wall layouts, one per seed.  The
+ * nodes it expands per search show how much work it saves, and every
+ * route has to be as short as the one Dijkstra's search finds.  Every
+ * layout needs to have a route, and a seed always has to give the same
+ * walls.
+ */
+
+static const struct
+{
+  AsternHeuristic  heuristic;
+  const char      *name;
+} heuristics[] =
+{
+  { astern_dijkstra,  "dijkstra"  },
+  { astern_euclid,    "euclid"    },
+  { astern_manhattan, "manhattan" },
+};
+
+#define N_HEURISTICS (sizeof (heuristics) / sizeof (heuristics[0]))
+
+
+/* returns the number of searches without a route or with a longer one
+ * than Dijkstra's */
+static int
+bench_search (int size,
+              int n_seeds)
+{
+  CubeGeometry geom;
+  Astern *astern;
+  int *lengths;
+  int n_failed = 0;
+  int seed, j;
+
+  cube_geometry_init (&geom, size, size, size, CUBE_ORDER_XYZ);
+  astern = astern_new (&geom);
+  lengths = malloc (n_seeds * sizeof (int));
+
+  for (j = 0; j < N_HEURISTICS; j++)
+    {
+      unsigned long expanded = 0;
+      int n_routes = 0, mismatches = 0;
+      double time = 0.0;
+
+      astern_set_heuristic (astern, heuristics[j].heuristic);
+
+      for (seed = 0; seed < n_seeds; seed++)
+        {
+          double t0;
+          int length;
+
+          /* the same walls for every heuristic */
+          astern_set_seed (astern, seed);
+          astern_reset (astern);
+
+          t0 = monotonic_now ();
+          while (astern_expand (astern) == 0)
+            ;
+          time += monotonic_now () - t0;
+
+          expanded += astern->n_expanded;
+          length = astern_path_length (astern);
+
+          if (j == 0)
+            lengths[seed] = length;
+          else if (length != lengths[seed])
+            mismatches++;
+
+          if (length >= 0)
+            n_routes++;
+        }
+
+      printf ("astern      %2d^3 %-9s: %9.1f expanded/search, "
+              "%8.3f ms/search, %6.3f us/node, %d/%d routed, %s\n",
+              size, heuristics[j].name,
+              (double) expanded / n_seeds,
+              time * 1000.0 / n_seeds,
+              expanded ? time * 1000000.0 / expanded : 0.0,
+              n_routes, n_seeds,
+              n_routes < n_seeds ? "FAILED" :
+              j == 0 ? "reference" : mismatches ? "FAILED" : "ok");
+
+      n_failed += mismatches + n_seeds - n_routes;
+    }
+
+  free (lengths);
+  astern_free (astern);
+
+  return n_failed;
+}
+
+
+/* the time per layout, and the same walls from the same seed */
+static int
+bench_walls (int size,
+             int n_layouts)
+{
+  WallMap *map, *again;
+  int n_cells = size * size * size;
+  int n_failed = 0, tries = 0, n_walls = 0;
+  double t0, time;
+  int i, j;
+
+  map = wall_map_new (size, size, size);
+  again = wall_map_new (size, size, size);
+
+  t0 = monotonic_now ();
+  for (i = 0; i < n_layouts; i++)
+    {
+      wall_map_seed (map, i);
+      tries += wall_map_generate (map, n_cells - 1, 0);
+    }
+  time = monotonic_now () - t0;
+
+  for (i = 0; i < n_layouts; i++)
+    {
+      wall_map_seed (map, i);
+      wall_map_seed (again, i);
+
+      if (wall_map_generate (map, n_cells - 1, 0) == 0 ||
+          wall_map_generate (again, n_cells - 1, 0) == 0 ||
+          memcmp (map->bits, again->bits,
+                  size * map->slab_words * sizeof (uint64_t)) != 0 ||
+          !wall_map_connected (map, n_cells - 1, 0))
+        n_failed++;
+
+      for (j = 0; j < size * map->slab_words; j++)
+        n_walls += __builtin_popcountll (map->bits[j]);
+    }
+
+  printf ("walls       %2d^3: %8.3f us/layout, %.2f tries/layout, "
+          "%.1f%% walls, %s\n",
+          size, time * 1000000.0 / n_layouts,
+          (double) tries / n_layouts,
+          100.0 * n_walls / n_layouts / n_cells,
+          n_failed ? "FAILED" : "ok");
+
+  wall_map_free (map);
+  wall_map_free (again);
+
+  return n_failed;
+}
+
+
+/* a simulated second at 20 frames per second, then a frame 5 s late
+ * with hardly any budget: it must not make all the steps it owes, the
+ * frames after it catch up */
+static int
+check_advance (int size)
+{
+  const double steps_per_second = 100.0;
+  CubeGeometry geom;
+  Astern *astern;
+  int n_failed = 0;
+  int i, expected, expanded;
+  double t;
+
+  cube_geometry_init (&geom, size, size, size, CUBE_ORDER_XYZ);
+  astern = astern_new (&geom);
+  astern_set_heuristic (astern, astern_dijkstra);
+
+  astern_set_seed (astern, 1);
+  astern_reset (astern);
+
+  for (i = 0; i <= 20; i++)
+    {
+      t = i * 0.05;
+      astern_advance (astern, t, steps_per_second, 0.0);
+    }
+
+  expected = 100;
+  expanded = astern->n_expanded;
+  if (expanded != expected)
+    n_failed++;
+
+  /* a late frame with a budget far too small for 500 steps */
+  t += 5.0;
+  astern_advance (astern, t, steps_per_second, 1e-9);
+  if (astern->n_expanded - expanded >= 500)
+    n_failed++;
+
+  for (i = 0; i < 1000 && astern->n_expanded < expected + 500; i++)
+    astern_advance (astern, t, steps_per_second, 1e-9);
+  if (astern->n_expanded != expected + 500 && astern->result == 0)
+    n_failed++;
+
+  printf ("advance     %2d^3: %d steps in 1 s at %.0f/s, %d after 5 s "
+          "late, %d frames to catch up, %s\n",
+          size, expanded, steps_per_second,
+          astern->n_expanded, i + 1, n_failed ? "FAILED" : "ok");
+
+  astern_free (astern);
+
+  return n_failed;
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+  int n_seeds = argc > 1 ? atoi (argv[1]) : 100;
+  int n_failed = 0;
+
+  n_failed += bench_search (8, n_seeds);
+  n_failed += bench_search (16, n_seeds);
+  n_failed += bench_search (32, MAX (n_seeds / 10, 1));
+
+  n_failed += bench_walls (8, n_seeds * 10);
+  n_failed += bench_walls (16, n_seeds * 10);
+  n_failed += bench_walls (32, n_seeds);
+  n_failed += bench_walls (64, MAX (n_seeds / 10, 1));
+
+  n_failed += check_advance (16);
+
+  return n_failed != 0;
+}
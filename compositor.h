@@ -0,0 +1,82 @@
+#ifndef __COMPOSITOR_H__
+#define __COMPOSITOR_H__
+
+#include "render-utils.h"
+
+/*
+ * Stacks effects on top of each other.  Every layer has a framebuffer
+ * of its own that a renderer paints into, an opacity and a blend mode
+ * for combining it with what's below.  The bottom layer gets blended
+ * onto black.
+ *
+ *   over      below + (layer - below) * opacity
+ *   add       below + layer * opacity
+ *   multiply  below + (below * layer - below) * opacity
+ *   max       below + (max (below, layer) - below) * opacity
+ *
+ * The result of every layer gets kept, so compositor_render () only
+ * redoes the stack from the lowest layer that changed.  Renderers have
+ * to call layer_mark_dirty () after painting into a layer, the setters
+ * take care of the rest.  Nothing below the topmost visible layer that
+ * is opaque (over at opacity 1.0) gets blended at all, and if nothing
+ * visible is above it either, its pixels are the frame as they are.
+ */
+
+typedef enum
+{
+  BLEND_OVER,
+  BLEND_ADD,
+  BLEND_MULTIPLY,
+  BLEND_MAX,
+} BlendMode;
+
+struct _layer
+{
+  pixel_t            *pixels;
+  double              opacity;
+  BlendMode           mode;
+  int                 visible;
+
+  /* private */
+  int                 dirty;
+  int                 valid;         /* result is up to date */
+  pixel_t            *composite;     /* this layer blended onto the ones below */
+  const pixel_t      *result;        /* composite, or what it would equal */
+};
+
+typedef struct _layer Layer;
+
+struct _compositor
+{
+  CubeGeometry        geometry;
+  int                 n_layers;
+  Layer             **layers;        /* bottom first */
+
+  /* private */
+  pixel_t            *black;
+  pixel_t            *output;        /* what the top layer blends into */
+};
+
+typedef struct _compositor Compositor;
+
+
+Compositor * compositor_new       (const CubeGeometry *geom);
+Layer *      compositor_add_layer (Compositor         *comp,
+                                   BlendMode           mode,
+                                   double              opacity);
+const pixel_t *
+             compositor_render    (Compositor         *comp,
+                                   pixel_t            *output);
+void         compositor_free      (Compositor         *comp);
+
+void         layer_mark_dirty     (Layer              *layer);
+void         layer_set_opacity    (Layer              *layer,
+                                   double              opacity);
+void         layer_set_blend_mode (Layer              *layer,
+                                   BlendMode           mode);
+void         layer_set_visible    (Layer              *layer,
+                                   int                 visible);
+void         layer_swap_pixels    (Layer              *a,
+                                   Layer              *b);
+
+#endif
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+
+#include "frame-scheduler.h"
+
+#define NSEC_PER_SEC 1000000000L
+#define FRAME_SCHEDULER_REPORT_INTERVAL 5.0
+
+
+static long long
+timespec_diff_ns (const struct timespec *a,
+                  const struct timespec *b)
+{
+  return (a->tv_sec - b->tv_sec) * (long long) NSEC_PER_SEC +
+         (a->tv_nsec - b->tv_nsec);
+}
+
+
+static void
+timespec_add_ns (struct timespec *ts,
+                 long long        ns)
+{
+  ns += ts->tv_nsec;
+  ts->tv_sec += ns / NSEC_PER_SEC;
+  ts->tv_nsec = ns % NSEC_PER_SEC;
+}
+
+
+FrameScheduler *
+frame_scheduler_new (double fps)
+{
+  FrameScheduler *sched = calloc (1, sizeof (FrameScheduler));
+
+  if (!frame_scheduler_set_fps (sched, fps))
+    {
+      free (sched);
+      return NULL;
+    }
+
+  clock_gettime (CLOCK_MONOTONIC, &sched->start);
+
+  return sched;
+}
+
+
+int
+frame_scheduler_set_fps (FrameScheduler *sched,
+                         double          fps)
+{
+  if (!(fps > 0.0 && fps <= 1000.0))
+    {
+      fprintf (stderr, "frame rate %g out of range\n", fps);
+      return 0;
+    }
+
+  /* takes effect for the deadline after the current one */
+  sched->period = NSEC_PER_SEC / fps + 0.5;
+
+  return 1;
+}
+
+
+static void
+frame_scheduler_report (FrameScheduler *sched,
+                        double          now)
+{
+  if (sched->missed == sched->missed_reported ||
+      now - sched->last_report < FRAME_SCHEDULER_REPORT_INTERVAL)
+    return;
+
+  fprintf (stderr,
+           "frame scheduler: %lu of %lu frames missed their deadline, "
+           "up to %.1f ms late\n",
+           sched->missed - sched->missed_reported,
+           sched->frames - sched->frames_reported,
+           sched->worst_unreported * 1000.0);
+
+  sched->frames_reported = sched->frames;
+  sched->missed_reported = sched->missed;
+  sched->worst_unreported = 0.0;
+  sched->last_report = now;
+}
+
+
+/* waits for the next deadline and returns its time in seconds since the
+ * first frame.  Renderers should animate with this instead of the time
+ * they actually got woken up, it advances by exactly one period per
+ * frame unless deadlines got skipped. */
+double
+frame_scheduler_wait (FrameScheduler *sched)
+{
+  struct timespec now;
+  long long late;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+
+  if (!sched->started)
+    {
+      /* the first frame goes out right away */
+      sched->started = 1;
+      sched->start = now;
+      sched->deadline = now;
+    }
+  else
+    {
+      timespec_add_ns (&sched->deadline, sched->period);
+      late = timespec_diff_ns (&now, &sched->deadline);
+
+      if (late > 0)
+        {
+          long long behind = late / sched->period;
+          double late_s = late / (double) NSEC_PER_SEC;
+
+          sched->missed++;
+          if (late_s > sched->max_late)
+            sched->max_late = late_s;
+          if (late_s > sched->worst_unreported)
+            sched->worst_unreported = late_s;
+
+          /* more than a period behind, don't try to catch up */
+          if (behind > 0)
+            {
+              sched->skipped += behind;
+              timespec_add_ns (&sched->deadline, behind * sched->period);
+            }
+        }
+      else
+        {
+          /* absolute deadline, simply retry when interrupted */
+          while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME,
+                                  &sched->deadline, NULL) == EINTR)
+            ;
+        }
+    }
+
+  sched->frames++;
+
+  frame_scheduler_report (sched,
+                          timespec_diff_ns (&now, &sched->start) /
+                          (double) NSEC_PER_SEC);
+
+  return timespec_diff_ns (&sched->deadline, &sched->start) /
+         (double) NSEC_PER_SEC;
+}
+
+
+/* seconds since the first frame, on the same clock as the deadlines */
+double
+frame_scheduler_now (FrameScheduler *sched)
+{
+  struct timespec now;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+
+  return timespec_diff_ns (&now, &sched->start) / (double) NSEC_PER_SEC;
+}
+
+
+void
+frame_scheduler_get_stats (FrameScheduler      *sched,
+                           FrameSchedulerStats *stats)
+{
+  stats->frames = sched->frames;
+  stats->missed = sched->missed;
+  stats->skipped = sched->skipped;
+  stats->max_late = sched->max_late;
+}
+
+
+void
+frame_scheduler_free (FrameScheduler *sched)
+{
+  free (sched);
+}
+
+
+double
+monotonic_now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1.0 + ts.tv_nsec / 1000000000.0;
+}
@@ -0,0 +1,57 @@
+#ifndef __FRAME_SCHEDULER_H__
+#define __FRAME_SCHEDULER_H__
+
+#include <time.h>
+
+/*
+ * Paces a render loop at a fixed frame rate.  The deadlines are
+ * absolute times on CLOCK_MONOTONIC, one period apart, so the time it
+ * takes to render and send a frame doesn't add up to drift.  A frame
+ * that starts after its deadline counts as missed; when the loop falls
+ * behind by whole periods these get skipped instead of rendering a
+ * burst of frames to catch up.
+ */
+
+struct _frame_scheduler
+{
+  struct timespec     start;
+  struct timespec     deadline;
+  long                period;        /* nanoseconds */
+  int                 started;
+
+  unsigned long       frames;
+  unsigned long       missed;
+  unsigned long       skipped;
+  double              max_late;
+
+  /* missed deadlines get reported on stderr at most every few seconds */
+  unsigned long       frames_reported;
+  unsigned long       missed_reported;
+  double              worst_unreported;
+  double              last_report;
+};
+
+typedef struct _frame_scheduler FrameScheduler;
+
+typedef struct
+{
+  unsigned long frames;
+  unsigned long missed;
+  unsigned long skipped;
+  double        max_late;            /* seconds */
+} FrameSchedulerStats;
+
+
+FrameScheduler * frame_scheduler_new       (double fps);
+int              frame_scheduler_set_fps   (FrameScheduler *sched,
+                                            double          fps);
+double           frame_scheduler_wait      (FrameScheduler *sched);
+double           frame_scheduler_now       (FrameScheduler *sched);
+void             frame_scheduler_get_stats (FrameScheduler      *sched,
+                                            FrameSchedulerStats *stats);
+void             frame_scheduler_free      (FrameScheduler *sched);
+
+/* seconds on CLOCK_MONOTONIC, for timing anything else the same way */
+double           monotonic_now             (void);
+
+#endif
@@ -0,0 +1,318 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <endian.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "frame-sequence.h"
+
+#define FRAME_SEQUENCE_ALIGN 4096
+
+_Static_assert (sizeof (FrameSequenceHeader) == 56,
+                "FrameSequenceHeader must match the file layout");
+
+
+FrameSequence *
+frame_sequence_open (const char *path)
+{
+  FrameSequenceHeader header;
+  FrameSequence *seq;
+  struct stat st;
+  uint64_t data_offset, prev = 0;
+  void *map;
+  int fd, i;
+
+  fd = open (path, O_RDONLY);
+  if (fd < 0)
+    {
+      perror (path);
+      return NULL;
+    }
+
+  if (fstat (fd, &st) < 0)
+    {
+      perror ("fstat");
+      close (fd);
+      return NULL;
+    }
+
+  if (st.st_size < sizeof (header))
+    {
+      fprintf (stderr, "%s is not a frame sequence\n", path);
+      close (fd);
+      return NULL;
+    }
+
+  map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+
+  if (map == MAP_FAILED)
+    {
+      perror ("mmap");
+      return NULL;
+    }
+
+  memcpy (&header, map, sizeof (header));
+
+  if (memcmp (header.magic, FRAME_SEQUENCE_MAGIC, 8) != 0 ||
+      le32toh (header.version) != FRAME_SEQUENCE_VERSION)
+    {
+      fprintf (stderr, "%s is not a frame sequence\n", path);
+      munmap (map, st.st_size);
+      return NULL;
+    }
+
+  seq = calloc (1, sizeof (FrameSequence));
+  seq->map = map;
+  seq->map_size = st.st_size;
+
+  if (!cube_geometry_init (&seq->geometry,
+                           le32toh (header.size_x),
+                           le32toh (header.size_y),
+                           le32toh (header.size_z),
+                           le32toh (header.order)))
+    goto fail;
+
+  seq->frame_size = le32toh (header.frame_size);
+  seq->n_frames = le32toh (header.n_frames);
+  seq->duration = le64toh (header.duration) / 1000000.0;
+  data_offset = le64toh (header.data_offset);
+
+  if (seq->frame_size != seq->geometry.fb_size ||
+      seq->n_frames < 1 ||
+      data_offset < sizeof (header) + seq->n_frames * sizeof (uint64_t) ||
+      data_offset > st.st_size ||
+      (st.st_size - data_offset) / seq->frame_size < seq->n_frames)
+    {
+      fprintf (stderr, "%s: inconsistent frame sequence header\n", path);
+      goto fail;
+    }
+
+  seq->timestamps = (const uint64_t *) ((const uint8_t *) map + sizeof (header));
+  seq->frames = (const uint8_t *) map + data_offset;
+
+  for (i = 0; i < seq->n_frames; i++)
+    {
+      if (le64toh (seq->timestamps[i]) < prev)
+        {
+          fprintf (stderr, "%s: timestamps out of order\n", path);
+          goto fail;
+        }
+
+      prev = le64toh (seq->timestamps[i]);
+    }
+
+  /* playback reads the frames front to back */
+  madvise (map, st.st_size, MADV_SEQUENTIAL);
+
+  return seq;
+
+fail:
+  munmap (map, st.st_size);
+  free (seq);
+  return NULL;
+}
+
+
+/* index of the frame on display at t seconds, the sequence loops */
+int
+frame_sequence_find (FrameSequence *seq,
+                     double         t)
+{
+  uint64_t us;
+  int lo, hi;
+
+  if (seq->duration > 0.0)
+    {
+      t = fmod (t, seq->duration);
+      if (t < 0.0)
+        t += seq->duration;
+    }
+
+  us = t > 0.0 ? (uint64_t) (t * 1000000.0) : 0;
+
+  /* the last frame with a timestamp <= us */
+  lo = 0;
+  hi = seq->n_frames - 1;
+
+  while (lo < hi)
+    {
+      int mid = (lo + hi + 1) / 2;
+
+      if (le64toh (seq->timestamps[mid]) <= us)
+        lo = mid;
+      else
+        hi = mid - 1;
+    }
+
+  return lo;
+}
+
+
+const uint8_t *
+frame_sequence_frame (FrameSequence *seq,
+                      int            index)
+{
+  if (index < 0 || index >= seq->n_frames)
+    return NULL;
+
+  return seq->frames + (size_t) index * seq->frame_size;
+}
+
+
+void
+frame_sequence_close (FrameSequence *seq)
+{
+  munmap (seq->map, seq->map_size);
+  free (seq);
+}
+
+
+FrameSequenceWriter *
+frame_sequence_writer_new (const char         *path,
+                           const CubeGeometry *geom,
+                           int                 n_frames)
+{
+  FrameSequenceWriter *writer;
+  uint64_t index_end;
+  int fd;
+
+  if (n_frames < 1)
+    {
+      fprintf (stderr, "a frame sequence needs at least one frame\n");
+      return NULL;
+    }
+
+  fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    {
+      perror (path);
+      return NULL;
+    }
+
+  writer = calloc (1, sizeof (FrameSequenceWriter));
+  writer->fd = fd;
+  writer->path = strdup (path);
+  writer->geometry = *geom;
+  writer->n_frames = n_frames;
+  writer->timestamps = calloc (n_frames, sizeof (uint64_t));
+
+  index_end = sizeof (FrameSequenceHeader) + n_frames * sizeof (uint64_t);
+  writer->data_offset = (index_end + FRAME_SEQUENCE_ALIGN - 1) /
+                        FRAME_SEQUENCE_ALIGN * FRAME_SEQUENCE_ALIGN;
+
+  return writer;
+}
+
+
+static int
+pwrite_all (int         fd,
+            const void *buf,
+            size_t      count,
+            off_t       offset)
+{
+  while (count > 0)
+    {
+      ssize_t res = pwrite (fd, buf, count, offset);
+
+      if (res < 0)
+        {
+          perror ("pwrite");
+          return 0;
+        }
+
+      buf = (const uint8_t *) buf + res;
+      count -= res;
+      offset += res;
+    }
+
+  return 1;
+}
+
+
+int
+frame_sequence_writer_add (FrameSequenceWriter *writer,
+                           double               timestamp,
+                           const uint8_t       *frame)
+{
+  uint64_t us = timestamp > 0.0 ? (uint64_t) (timestamp * 1000000.0 + 0.5) : 0;
+  int n = writer->n_written;
+
+  if (n >= writer->n_frames)
+    {
+      fprintf (stderr, "frame sequence already has %d frames\n", n);
+      return 0;
+    }
+
+  if (n > 0 && us < le64toh (writer->timestamps[n - 1]))
+    {
+      fprintf (stderr, "frame sequence timestamps must not decrease\n");
+      return 0;
+    }
+
+  if (!pwrite_all (writer->fd, frame, writer->geometry.fb_size,
+                   writer->data_offset + (off_t) n * writer->geometry.fb_size))
+    return 0;
+
+  writer->timestamps[n] = htole64 (us);
+  writer->n_written++;
+
+  return 1;
+}
+
+
+/* writes the header and the index and frees the writer.  A sequence
+ * that didn't get all of its frames gets removed again. */
+int
+frame_sequence_writer_finish (FrameSequenceWriter *writer,
+                              double               duration)
+{
+  FrameSequenceHeader header;
+  int success = 0;
+
+  if (writer->n_written != writer->n_frames)
+    {
+      fprintf (stderr, "frame sequence has %d of %d frames\n",
+               writer->n_written, writer->n_frames);
+      goto out;
+    }
+
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, FRAME_SEQUENCE_MAGIC, 8);
+  header.version = htole32 (FRAME_SEQUENCE_VERSION);
+  header.size_x = htole32 (writer->geometry.size_x);
+  header.size_y = htole32 (writer->geometry.size_y);
+  header.size_z = htole32 (writer->geometry.size_z);
+  header.order = htole32 (writer->geometry.order);
+  header.frame_size = htole32 (writer->geometry.fb_size);
+  header.n_frames = htole32 (writer->n_frames);
+  header.duration = htole64 ((uint64_t) (duration * 1000000.0 + 0.5));
+  header.data_offset = htole64 (writer->data_offset);
+
+  if (!pwrite_all (writer->fd, &header, sizeof (header), 0) ||
+      !pwrite_all (writer->fd, writer->timestamps,
+                   writer->n_frames * sizeof (uint64_t), sizeof (header)))
+    goto out;
+
+  success = 1;
+
+out:
+  if (close (writer->fd) < 0)
+    {
+      perror ("close");
+      success = 0;
+    }
+
+  if (!success)
+    unlink (writer->path);
+
+  free (writer->timestamps);
+  free (writer->path);
+  free (writer);
+
+  return success;
+}
@@ -0,0 +1,85 @@
+#ifndef __FRAME_SEQUENCE_H__
+#define __FRAME_SEQUENCE_H__
+
+#include <stdint.h>
+
+#include "render-utils.h"
+
+/*
+ * Pre-rendered animations for the cube.  A sequence file holds the
+ * frames exactly as they go out over OPC, 8 bit RGB in the pixel order
+ * of the cube, so playing it back is a lookup and a copy per frame.
+ * The file gets mmap ()ed, nothing is decoded.
+ *
+ * Layout, all integers little endian:
+ *
+ *   FrameSequenceHeader        56 bytes
+ *   uint64_t timestamps[n]     display time of every frame in
+ *                              microseconds, ascending, the first is 0
+ *   padding                    up to data_offset (page aligned)
+ *   uint8_t  frames[n][frame_size]
+ */
+
+#define FRAME_SEQUENCE_MAGIC   "OPCFSEQ"
+#define FRAME_SEQUENCE_VERSION 1
+
+typedef struct
+{
+  char                magic[8];
+  uint32_t            version;
+  uint32_t            size_x, size_y, size_z;
+  uint32_t            order;         /* CubeOrder */
+  uint32_t            frame_size;    /* bytes per frame */
+  uint32_t            n_frames;
+  uint32_t            reserved;
+  uint64_t            duration;      /* microseconds, for looping */
+  uint64_t            data_offset;
+} FrameSequenceHeader;
+
+struct _frame_sequence
+{
+  void               *map;
+  size_t              map_size;
+
+  CubeGeometry        geometry;
+  int                 frame_size;
+  int                 n_frames;
+  double              duration;      /* seconds */
+
+  const uint64_t     *timestamps;
+  const uint8_t      *frames;
+};
+
+typedef struct _frame_sequence FrameSequence;
+
+struct _frame_sequence_writer
+{
+  int                 fd;
+  char               *path;
+  CubeGeometry        geometry;
+  int                 n_frames;
+  int                 n_written;
+  uint64_t           *timestamps;
+  uint64_t            data_offset;
+};
+
+typedef struct _frame_sequence_writer FrameSequenceWriter;
+
+
+FrameSequence *       frame_sequence_open          (const char *path);
+int                   frame_sequence_find          (FrameSequence *seq,
+                                                    double         t);
+const uint8_t *       frame_sequence_frame         (FrameSequence *seq,
+                                                    int            index);
+void                  frame_sequence_close         (FrameSequence *seq);
+
+FrameSequenceWriter * frame_sequence_writer_new    (const char         *path,
+                                                    const CubeGeometry *geom,
+                                                    int                 n_frames);
+int                   frame_sequence_writer_add    (FrameSequenceWriter *writer,
+                                                    double               timestamp,
+                                                    const uint8_t       *frame);
+int                   frame_sequence_writer_finish (FrameSequenceWriter *writer,
+                                                    double               duration);
+
+#endif
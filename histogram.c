@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "histogram.h"
+
+#define HISTOGRAM_CAP ((1ULL << (HISTOGRAM_MAX_SHIFT + 1)) - 1)
+
+
+static int
+histogram_bucket (uint64_t ns)
+{
+  int shift;
+
+  if (ns < HISTOGRAM_LINEAR)
+    return ns;
+
+  shift = 63 - __builtin_clzll (ns);
+
+  return HISTOGRAM_LINEAR + (shift - 4) * HISTOGRAM_SUB +
+         ((ns >> (shift - 3)) & (HISTOGRAM_SUB - 1));
+}
+
+
+/* the middle of a bucket, in nanoseconds */
+static double
+histogram_bucket_value (int bucket)
+{
+  int shift, sub;
+
+  if (bucket < HISTOGRAM_LINEAR)
+    return bucket;
+
+  shift = 4 + (bucket - HISTOGRAM_LINEAR) / HISTOGRAM_SUB;
+  sub = (bucket - HISTOGRAM_LINEAR) % HISTOGRAM_SUB;
+
+  return (double) ((HISTOGRAM_SUB + sub) * (1ULL << (shift - 3))) +
+         (1ULL << (shift - 3)) / 2.0;
+}
+
+
+void
+histogram_record (Histogram *hist,
+                  double     seconds)
+{
+  uint64_t ns, max;
+
+  /* also catches NaN */
+  if (!(seconds > 0.0))
+    ns = 0;
+  else if (seconds >= HISTOGRAM_CAP / 1000000000.0)
+    ns = HISTOGRAM_CAP;
+  else
+    ns = seconds * 1000000000.0;
+
+  atomic_fetch_add_explicit (&hist->count, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit (&hist->sum, ns, memory_order_relaxed);
+  atomic_fetch_add_explicit (&hist->buckets[histogram_bucket (ns)], 1,
+                             memory_order_relaxed);
+
+  max = atomic_load_explicit (&hist->max, memory_order_relaxed);
+  while (ns > max &&
+         !atomic_compare_exchange_weak_explicit (&hist->max, &max, ns,
+                                                 memory_order_relaxed,
+                                                 memory_order_relaxed))
+    ;
+}
+
+
+/* the duration p (0.0 .. 1.0) of all recorded ones are at most, in
+ * seconds.  0.0 when nothing got recorded. */
+double
+histogram_percentile (const Histogram *hist,
+                      double           p)
+{
+  unsigned long count, rank, seen = 0;
+  double max;
+  int i;
+
+  count = atomic_load_explicit (&hist->count, memory_order_relaxed);
+  if (count == 0)
+    return 0.0;
+
+  rank = p <= 0.0 ? 1 : p >= 1.0 ? count : (unsigned long) (p * count + 0.5);
+  if (rank < 1)
+    rank = 1;
+
+  max = histogram_max (hist);
+
+  for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+      seen += atomic_load_explicit (&hist->buckets[i], memory_order_relaxed);
+
+      if (seen >= rank)
+        {
+          double value = histogram_bucket_value (i) / 1000000000.0;
+
+          return value < max ? value : max;
+        }
+    }
+
+  /* a record in progress, the buckets lag behind the count */
+  return max;
+}
+
+
+double
+histogram_mean (const Histogram *hist)
+{
+  unsigned long count, sum;
+
+  count = atomic_load_explicit (&hist->count, memory_order_relaxed);
+  sum = atomic_load_explicit (&hist->sum, memory_order_relaxed);
+
+  return count ? sum / 1000000000.0 / count : 0.0;
+}
+
+
+double
+histogram_max (const Histogram *hist)
+{
+  return atomic_load_explicit (&hist->max, memory_order_relaxed) /
+         1000000000.0;
+}
+
+
+/* only safe while nobody records */
+void
+histogram_reset (Histogram *hist)
+{
+  memset (hist, 0, sizeof (Histogram));
+}
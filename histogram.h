@@ -0,0 +1,38 @@
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+#include <stdatomic.h>
+
+/*
+ * Distribution of durations, cheap enough to record on every frame.
+ * Durations are counted in nanoseconds: exactly below 16 ns, above that
+ * in 8 buckets per power of two, so a percentile is off by at most 1/16
+ * of its value.  Recording doesn't allocate or lock, just does relaxed
+ * atomic adds, so any thread can record while another one reads.
+ * A zeroed Histogram is empty.
+ */
+
+#define HISTOGRAM_LINEAR    16
+#define HISTOGRAM_SUB       8
+#define HISTOGRAM_MAX_SHIFT 40       /* caps durations at 2^41 ns, 36 min */
+#define HISTOGRAM_BUCKETS \
+  (HISTOGRAM_LINEAR + (HISTOGRAM_MAX_SHIFT - 3) * HISTOGRAM_SUB)
+
+typedef struct
+{
+  atomic_ulong        count;
+  atomic_ulong        sum;           /* nanoseconds */
+  atomic_ulong        max;
+  atomic_ulong        buckets[HISTOGRAM_BUCKETS];
+} Histogram;
+
+
+void   histogram_record     (Histogram       *hist,
+                             double           seconds);
+double histogram_percentile (const Histogram *hist,
+                             double           p);
+double histogram_mean       (const Histogram *hist);
+double histogram_max        (const Histogram *hist);
+void   histogram_reset      (Histogram       *hist);
+
+#endif
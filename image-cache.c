@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "render-utils.h"
+#include "image-cache.h"
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static Image *cache = NULL;
+
+
+/* a missing file has an all zero identity, so a failed lookup gets
+ * cached as well and isn't retried until the file shows up */
+static int
+image_matches (const Image       *image,
+               const struct stat *st)
+{
+  return image->mtime.tv_sec == st->st_mtim.tv_sec &&
+         image->mtime.tv_nsec == st->st_mtim.tv_nsec &&
+         image->size == st->st_size &&
+         image->ino == st->st_ino;
+}
+
+
+static void
+image_unref_locked (Image *image)
+{
+  image->ref_count--;
+
+  if (image->ref_count > 0)
+    return;
+
+  free (image->pixels);
+  free (image->path);
+  free (image);
+}
+
+
+/* returns a new reference to the decoded image, at least rows
+ * row_start to row_start + n_rows - 1 of it (n_rows < 0 for all of
+ * them), or NULL if the file can't be read.  The result must be
+ * released with image_unref (). */
+const Image *
+image_cache_get_rows (const char *path,
+                      int         row_start,
+                      int         n_rows)
+{
+  struct stat st;
+  Image *image, **link;
+  const Image *ret = NULL;
+  int row_end;
+
+  row_start = MAX (row_start, 0);
+  row_end = n_rows < 0 ? INT_MAX : row_start + n_rows;
+
+  if (stat (path, &st) < 0)
+    memset (&st, 0, sizeof (st));
+
+  pthread_mutex_lock (&cache_lock);
+
+  for (link = &cache; *link; link = &(*link)->next)
+    {
+      if (strcmp ((*link)->path, path) == 0)
+        break;
+    }
+
+  image = *link;
+
+  if (image && !image_matches (image, &st))
+    {
+      /* changed on disk, current users keep the old pixels */
+      *link = image->next;
+      image->next = NULL;
+      image_unref_locked (image);
+      image = NULL;
+    }
+
+  if (image && image->pixels &&
+      (row_start < image->row_start ||
+       MIN (row_end, image->height) > image->row_start + image->n_rows))
+    {
+      /* the new image keeps the rows of the old one */
+      row_start = MIN (row_start, image->row_start);
+      row_end = MAX (row_end, image->row_start + image->n_rows);
+
+      *link = image->next;
+      image->next = NULL;
+      image_unref_locked (image);
+      image = NULL;
+    }
+
+  if (!image)
+    {
+      image = calloc (1, sizeof (Image));
+      if (image)
+        image->path = strdup (path);
+
+      if (!image || !image->path)
+        {
+          perror ("image_cache_get");
+          free (image);
+          pthread_mutex_unlock (&cache_lock);
+          return NULL;
+        }
+
+      image->ref_count = 1;  /* the cache's */
+      image->mtime = st.st_mtim;
+      image->size = st.st_size;
+      image->ino = st.st_ino;
+
+      if (st.st_ino == 0)
+        {
+          fprintf (stderr, "Image %s doesn't exist\n", path);
+        }
+      else if (read_png_rows (image->path, IMAGE_FORMAT_U8, row_start,
+                              row_end == INT_MAX ? -1 : row_end - row_start,
+                              &image->width, &image->height,
+                              &image->rowstride,
+                              (void **) &image->pixels) < 0)
+        {
+          fprintf (stderr, "failed to load image %s\n", path);
+          image->pixels = NULL;
+        }
+      else
+        {
+          /* read_png_rows () stops at the bottom of the image */
+          image->row_start = MIN (row_start, image->height);
+          image->n_rows = MIN (row_end, image->height) - image->row_start;
+        }
+
+      image->next = cache;
+      cache = image;
+    }
+
+  if (image->pixels)
+    {
+      image->ref_count++;
+      ret = image;
+    }
+
+  pthread_mutex_unlock (&cache_lock);
+
+  return ret;
+}
+
+
+/* the whole image */
+const Image *
+image_cache_get (const char *path)
+{
+  return image_cache_get_rows (path, 0, -1);
+}
+
+
+const Image *
+image_ref (const Image *image)
+{
+  pthread_mutex_lock (&cache_lock);
+  ((Image *) image)->ref_count++;
+  pthread_mutex_unlock (&cache_lock);
+
+  return image;
+}
+
+
+void
+image_unref (const Image *image)
+{
+  if (!image)
+    return;
+
+  pthread_mutex_lock (&cache_lock);
+  image_unref_locked ((Image *) image);
+  pthread_mutex_unlock (&cache_lock);
+}
+
+
+/* drops the cache's references, images in use stay alive until their
+ * last user releases them */
+void
+image_cache_flush (void)
+{
+  Image *image, *next;
+
+  pthread_mutex_lock (&cache_lock);
+
+  for (image = cache; image; image = next)
+    {
+      next = image->next;
+      image->next = NULL;
+      image_unref_locked (image);
+    }
+
+  cache = NULL;
+
+  pthread_mutex_unlock (&cache_lock);
+}
@@ -0,0 +1,50 @@
+#ifndef __IMAGE_CACHE_H__
+#define __IMAGE_CACHE_H__
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+/*
+ * Decoded images, shared between everyone who asks for the same path.
+ * An image gets decoded once and stays cached until the file changes
+ * (mtime, size or inode), then the next lookup decodes it again.  The
+ * pixels are 8 bit RGB for sample_buffer_u8 () and read-only, callers
+ * hold a reference until they are done with them, so an image replaced
+ * in the cache stays valid for whoever still uses it.
+ *
+ * image_cache_get_rows () only decodes the rows a caller asks for.  A
+ * later lookup that needs more rows decodes the file again, with the
+ * rows of both, and replaces the cached image.
+ */
+
+struct _image
+{
+  char               *path;
+  int                 width;
+  int                 height;
+  int                 rowstride;
+  int                 row_start;     /* the rows in pixels, of height */
+  int                 n_rows;
+  uint8_t            *pixels;
+
+  /* private */
+  int                 ref_count;
+  struct timespec     mtime;
+  off_t               size;
+  ino_t               ino;
+  struct _image      *next;
+};
+
+typedef struct _image Image;
+
+
+const Image * image_cache_get      (const char  *path);
+const Image * image_cache_get_rows (const char  *path,
+                                    int          row_start,
+                                    int          n_rows);
+const Image * image_ref            (const Image *image);
+void          image_unref          (const Image *image);
+void          image_cache_flush    (void);
+
+#endif
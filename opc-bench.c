@@ -0,0 +1,530 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <math.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+
+#include "frame-scheduler.h"
+#include "opc-client.h"
+
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
+
+/*
+ * Microbenchmark for the OPC sender hot path.
+ *
+ * The client is hooked up to one end of a socketpair, a child process
+ * drains the other end.  malloc() and friends are wrapped at link time
+ * (-Wl,--wrap=...) so we can count heap allocations per frame.
+ */
+
+void *__real_malloc  (size_t size);
+void *__real_calloc  (size_t nmemb, size_t size);
+void *__real_realloc (void *ptr, size_t size);
+
+static long n_allocs = 0;
+
+void *
+__wrap_malloc (size_t size)
+{
+  n_allocs++;
+  return __real_malloc (size);
+}
+
+void *
+__wrap_calloc (size_t nmemb,
+               size_t size)
+{
+  n_allocs++;
+  return __real_calloc (nmemb, size);
+}
+
+void *
+__wrap_realloc (void   *ptr,
+                size_t  size)
+{
+  n_allocs++;
+  return __real_realloc (ptr, size);
+}
+
+
+static pid_t
+spawn_drain (int fd,
+             int peer_fd)
+{
+  pid_t pid;
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      char buf[65536];
+
+      close (peer_fd);
+      while (read (fd, buf, sizeof (buf)) > 0)
+        ;
+      _exit (0);
+    }
+
+  return pid;
+}
+
+
+static void
+bench_write (int fb_size,
+             int n_channels,
+             int n_frames)
+{
+  pixel_t *framebuffer;
+  OpcClient *client;
+  int sv[2];
+  pid_t pid;
+  long allocs;
+  double t0, t1;
+  int i;
+
+  framebuffer = calloc (fb_size, sizeof (pixel_t));
+  for (i = 0; i < fb_size; i++)
+    framebuffer[i] = PIXEL_FROM_DOUBLE (drand48 ());
+
+  client = opc_client_new ("localhost:7890", 7890, fb_size, framebuffer);
+  if (!client)
+    {
+      fprintf (stderr, "can't create client\n");
+      exit (1);
+    }
+
+  if (socketpair (AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+    {
+      perror ("socketpair");
+      exit (1);
+    }
+
+  for (i = 0; n_channels > 1 && i < n_channels; i++)
+    {
+      opc_client_add_channel (client, i + 1,
+                              i * (fb_size / n_channels),
+                              fb_size / n_channels);
+    }
+
+  /* send every frame in full, no delta suppression */
+  opc_client_set_keepalive (client, 0.0);
+
+  pid = spawn_drain (sv[1], sv[0]);
+  close (sv[1]);
+  client->fd = sv[0];
+
+  /* warm up */
+  opc_client_write (client, 0, 0);
+
+  allocs = n_allocs;
+  t0 = monotonic_now ();
+
+  for (i = 0; i < n_frames; i++)
+    opc_client_write (client, 0, 0);
+
+  t1 = monotonic_now ();
+  allocs = n_allocs - allocs;
+
+  printf ("write       fb_size %6d, %2d channels: %8.2f us/frame, %.3f allocs/frame\n",
+          fb_size, n_channels,
+          (t1 - t0) * 1000000.0 / n_frames,
+          ((double) allocs) / n_frames);
+
+  opc_client_free (client);
+  waitpid (pid, NULL, 0);
+  free (framebuffer);
+}
+
+
+/* a static scene where only one of n_channels channels animates,
+ * shows what delta suppression saves */
+static void
+bench_delta (int fb_size,
+             int n_channels,
+             int n_frames)
+{
+  pixel_t *framebuffer;
+  OpcClient *client;
+  OpcClientStats stats;
+  int sv[2];
+  pid_t pid;
+  double t0, t1;
+  int i;
+
+  framebuffer = calloc (fb_size, sizeof (pixel_t));
+  for (i = 0; i < fb_size; i++)
+    framebuffer[i] = PIXEL_FROM_DOUBLE (drand48 ());
+
+  client = opc_client_new ("localhost:7890", 7890, fb_size, framebuffer);
+  if (!client)
+    {
+      fprintf (stderr, "can't create client\n");
+      exit (1);
+    }
+
+  for (i = 0; n_channels > 1 && i < n_channels; i++)
+    {
+      opc_client_add_channel (client, i + 1,
+                              i * (fb_size / n_channels),
+                              fb_size / n_channels);
+    }
+
+  if (socketpair (AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+    {
+      perror ("socketpair");
+      exit (1);
+    }
+
+  pid = spawn_drain (sv[1], sv[0]);
+  close (sv[1]);
+  client->fd = sv[0];
+
+  t0 = monotonic_now ();
+
+  for (i = 0; i < n_frames; i++)
+    {
+      /* every 10th frame changes a pixel in the first channel */
+      if (i % 10 == 0)
+        framebuffer[0] = PIXEL_FROM_DOUBLE (drand48 ());
+
+      opc_client_write (client, 0, 0);
+    }
+
+  t1 = monotonic_now ();
+
+  opc_client_get_stats (client, &stats);
+
+  printf ("delta       fb_size %6d, %2d channels: %8.2f us/frame, "
+          "%lu sent, %lu skipped, %lu bytes sent, %lu bytes saved (%.1f%%)\n",
+          fb_size, n_channels,
+          (t1 - t0) * 1000000.0 / n_frames,
+          stats.frames_sent, stats.frames_skipped,
+          stats.bytes_sent, stats.bytes_saved,
+          100.0 * stats.bytes_saved / (stats.bytes_saved + stats.bytes_sent));
+
+  opc_client_free (client);
+  waitpid (pid, NULL, 0);
+  free (framebuffer);
+}
+
+
+/* publishes frames as fast as possible while a deliberately slow reader
+ * drains the socket: the render side must never block, stale frames
+ * get dropped */
+static void
+bench_async (int fb_size,
+             int n_frames)
+{
+  pixel_t *framebuffer;
+  OpcClient *client;
+  OpcClientStats stats;
+  int sv[2];
+  pid_t pid;
+  double t0, t1, worst = 0.0;
+  int i;
+
+  framebuffer = calloc (fb_size, sizeof (pixel_t));
+
+  client = opc_client_new ("localhost:7890", 7890, fb_size, framebuffer);
+  if (!client)
+    {
+      fprintf (stderr, "can't create client\n");
+      exit (1);
+    }
+
+  if (socketpair (AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+    {
+      perror ("socketpair");
+      exit (1);
+    }
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      char buf[4096];
+
+      close (sv[0]);
+      while (read (sv[1], buf, sizeof (buf)) > 0)
+        usleep (100);
+      _exit (0);
+    }
+
+  close (sv[1]);
+  client->fd = sv[0];
+  opc_client_start_async (client);
+
+  t0 = monotonic_now ();
+  for (i = 0; i < n_frames; i++)
+    {
+      double ts = monotonic_now ();
+
+      framebuffer[i % fb_size] = PIXEL_FROM_DOUBLE (drand48 ());
+      opc_client_write (client, 0, 0);
+
+      worst = MAX (worst, monotonic_now () - ts);
+    }
+  t1 = monotonic_now ();
+
+  opc_client_get_stats (client, &stats);
+
+  printf ("async       fb_size %6d: %8.2f us/publish (worst %.2f us), "
+          "%lu published, %lu sent, %lu dropped\n",
+          fb_size,
+          (t1 - t0) * 1000000.0 / n_frames, worst * 1000000.0,
+          stats.frames_published, stats.frames_sent, stats.frames_dropped);
+
+  opc_client_free (client);
+  waitpid (pid, NULL, 0);
+  free (framebuffer);
+}
+
+
+/* reads back one frame and checks every OPC header: channel in byte 0,
+ * command in byte 1, then the big endian length.  Without a channel
+ * map the frame goes out on channel 7. */
+static int
+check_header (int fb_size,
+              int n_channels)
+{
+  const int total = 4 * MAX (n_channels, 1) + fb_size;
+  pixel_t *framebuffer;
+  OpcClient *client;
+  uint8_t *buf;
+  int sv[2];
+  int got = 0, pos = 0, failed = 0;
+  int i;
+
+  framebuffer = calloc (fb_size, sizeof (pixel_t));
+  buf = malloc (total);
+
+  client = opc_client_new ("localhost:7890", 7890, fb_size, framebuffer);
+  if (!client || !framebuffer || !buf)
+    {
+      fprintf (stderr, "can't create client\n");
+      exit (1);
+    }
+
+  if (socketpair (AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+    {
+      perror ("socketpair");
+      exit (1);
+    }
+
+  for (i = 0; n_channels > 1 && i < n_channels; i++)
+    {
+      opc_client_add_channel (client, i + 1,
+                              i * (fb_size / n_channels),
+                              fb_size / n_channels);
+    }
+
+  client->fd = sv[0];
+  opc_client_write (client, 7, 0);
+
+  /* the frame fits the socket buffer, it is all there already */
+  while (got < total)
+    {
+      int res = read (sv[1], buf + got, total - got);
+
+      if (res <= 0)
+        {
+          perror ("read");
+          failed = 1;
+          break;
+        }
+
+      got += res;
+    }
+
+  for (i = 0; !failed && i < MAX (n_channels, 1); i++)
+    {
+      int channel = n_channels > 1 ? i + 1 : 7;
+      int length = n_channels > 1 ? fb_size / n_channels : fb_size;
+
+      if (pos + 4 > got ||
+          buf[pos] != channel || buf[pos + 1] != 0 ||
+          (buf[pos + 2] << 8 | buf[pos + 3]) != length)
+        failed = 1;
+
+      pos += 4 + length;
+    }
+
+  printf ("header      fb_size %6d, %2d channels: %s\n",
+          fb_size, n_channels, failed ? "FAILED" : "ok");
+
+  opc_client_free (client);
+  close (sv[1]);
+  free (framebuffer);
+  free (buf);
+
+  return !failed;
+}
+
+
+static const struct
+{
+  OpcQuantizeImpl  impl;
+  const char      *name;
+} quantize_impls[] =
+{
+  { OPC_QUANTIZE_SCALAR, "scalar" },
+  { OPC_QUANTIZE_SSE2,   "sse2"   },
+  { OPC_QUANTIZE_AVX2,   "avx2"   },
+};
+
+#define N_QUANTIZE_IMPLS (sizeof (quantize_impls) / sizeof (quantize_impls[0]))
+
+
+/* compares every implementation against the scalar one, including
+ * out-of-range values, NaN and the rounding boundaries */
+static int
+check_quantize (void)
+{
+  const int n = 4099;  /* deliberately not a multiple of the vector width */
+  pixel_t *src;
+  uint8_t *ref, *out;
+  int failed = 0;
+  int i, j;
+
+  src = malloc (n * sizeof (pixel_t));
+  ref = malloc (n);
+  out = malloc (n);
+
+  for (i = 0; i < n; i++)
+    {
+      switch (i % 8)
+        {
+          case 0:
+            src[i] = PIXEL_FROM_DOUBLE (drand48 () * 3.0 - 1.0);
+            break;
+          case 1:
+            src[i] = PIXEL_FROM_DOUBLE (((i / 8) % 256 + 0.5) / 255.0);
+            break;
+          case 2:
+            src[i] = PIXEL_FROM_DOUBLE (NAN);
+            break;
+          case 3:
+            src[i] = PIXEL_FROM_DOUBLE (-INFINITY);
+            break;
+          case 4:
+            src[i] = PIXEL_FROM_DOUBLE (INFINITY);
+            break;
+          default:
+            src[i] = PIXEL_FROM_DOUBLE (drand48 ());
+            break;
+        }
+    }
+
+  opc_quantize_set_impl (OPC_QUANTIZE_SCALAR);
+  opc_quantize (ref, src, n);
+
+  for (j = 1; j < N_QUANTIZE_IMPLS; j++)
+    {
+      int mismatches = 0;
+
+      if (!opc_quantize_set_impl (quantize_impls[j].impl))
+        continue;
+
+      memset (out, 0xaa, n);
+      opc_quantize (out, src, n);
+
+      for (i = 0; i < n; i++)
+        {
+          if (out[i] != ref[i])
+            mismatches++;
+        }
+
+      printf ("quantize    %-6s: %s (%d mismatches)\n",
+              quantize_impls[j].name,
+              mismatches ? "FAILED" : "ok", mismatches);
+
+      if (mismatches)
+        failed = 1;
+    }
+
+  opc_quantize_set_impl (OPC_QUANTIZE_AUTO);
+
+  free (src);
+  free (ref);
+  free (out);
+
+  return !failed;
+}
+
+
+static void
+bench_quantize (int fb_size,
+                int n_iter)
+{
+  pixel_t *src;
+  uint8_t *dst;
+  int i, j;
+
+  src = malloc (fb_size * sizeof (pixel_t));
+  dst = malloc (fb_size);
+
+  for (i = 0; i < fb_size; i++)
+    src[i] = PIXEL_FROM_DOUBLE (drand48 ());
+
+  for (j = 0; j < N_QUANTIZE_IMPLS; j++)
+    {
+      double t0, t1;
+
+      if (!opc_quantize_set_impl (quantize_impls[j].impl))
+        continue;
+
+      opc_quantize (dst, src, fb_size);
+
+      t0 = monotonic_now ();
+      for (i = 0; i < n_iter; i++)
+        opc_quantize (dst, src, fb_size);
+      t1 = monotonic_now ();
+
+      printf ("quantize    fb_size %6d %-6s: %8.3f us/frame, %6.2f ns/channel\n",
+              fb_size, quantize_impls[j].name,
+              (t1 - t0) * 1000000.0 / n_iter,
+              (t1 - t0) * 1000000000.0 / n_iter / fb_size);
+    }
+
+  opc_quantize_set_impl (OPC_QUANTIZE_AUTO);
+
+  free (src);
+  free (dst);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+  int n_frames = argc > 1 ? atoi (argv[1]) : 10000;
+
+  signal (SIGPIPE, SIG_IGN);
+
+  if (!check_quantize ())
+    return 1;
+
+  if (!check_header (8 * 8 * 8 * 3, 1) ||
+      !check_header (16 * 16 * 16 * 3, 8))
+    return 1;
+
+  bench_quantize (8 * 8 * 8 * 3, n_frames);
+  bench_quantize (16 * 16 * 16 * 3, n_frames);
+  bench_quantize (21845 * 3, n_frames / 10);
+
+  bench_write (8 * 8 * 8 * 3, 1, n_frames);
+  bench_write (16 * 16 * 16 * 3, 1, n_frames);
+  bench_write (16 * 16 * 16 * 3, 8, n_frames);
+  bench_write (21845 * 3, 1, n_frames / 10);
+  bench_write (32 * 32 * 32 * 3, 64, n_frames / 10);
+
+  bench_delta (8 * 8 * 8 * 3, 1, n_frames);
+  bench_delta (16 * 16 * 16 * 3, 8, n_frames);
+
+  bench_async (8 * 8 * 8 * 3, n_frames);
+  bench_async (21845 * 3, n_frames / 10);
+
+  return 0;
+}
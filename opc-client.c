@@ -1,34 +1,94 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <signal.h>
 #include <netdb.h>
 #include <math.h>
 #include <sys/time.h>
+#include <time.h>
 
+#include "frame-scheduler.h"
 #include "opc-client.h"
 
+/* marks the mailbox slot as holding a frame the sender has not seen yet */
+#define SLOT_FRESH 0x4
+
+/* reconnect delay in seconds, doubles with every failed round */
+#define OPC_BACKOFF_MIN 0.1
+#define OPC_BACKOFF_MAX 5.0
+#define OPC_CONNECT_POLL_MS 20
+
+/* The largest UDP payload, the datagram limit without a channel map.
+ * A channel packet can't be split, OPC has no offset field, and the
+ * default map sends the whole framebuffer as one channel: 1540 bytes
+ * for the 8x8x8 cube, more than fits an ethernet frame.  A lower limit
+ * would only fragment the same datagram and warn about it on every
+ * connect.  A channel map packs its channels into datagrams of at most
+ * OPC_ETHERNET_MTU instead, losing a fragment of one of them must not
+ * lose every channel packed with it. */
+#define OPC_DEFAULT_MTU 65507
+
+/* unchanged frames get suppressed, but resent at least this often (s) */
+#define OPC_DEFAULT_KEEPALIVE 1.0
+
 OpcClient *
-opc_client_new (char   *hostport,
-                int     default_port,
-                int     fb_size,
-                double *framebuffer)
+opc_client_new (char    *hostport,
+                int      default_port,
+                int      fb_size,
+                pixel_t *framebuffer)
 {
-  char *host, *colon;
+  char *host, *colon, *name;
   struct addrinfo wish = { 0, 0, SOCK_STREAM, 0, 0, NULL, NULL, NULL };
   int success = 0;
 
   OpcClient *client = calloc (1, sizeof (OpcClient));
 
   client->fd = -1;
-  client->fb_size = fb_size;
-  client->framebuffer = framebuffer;
+  client->pending_fd = -1;
+  client->wakeup_fd = -1;
+  client->backoff = OPC_BACKOFF_MIN;
+  client->mtu = 0;
+  client->keepalive = OPC_DEFAULT_KEEPALIVE;
+  client->channels = calloc (1, sizeof (OpcChannel));
+
+  if (!opc_client_set_framebuffer (client, fb_size, framebuffer))
+    {
+      free (client->packet);
+      free (client->iov);
+      free (client->msgs);
+      free (client->last);
+      free (client->dirty);
+      free (client->channels);
+      free (client);
+      return NULL;
+    }
+
+  host = name = strdup (hostport);
+
+  /* optional transport prefix, "udp://host:port" */
+  if (strncmp (host, "udp://", 6) == 0)
+    {
+      wish.ai_socktype = SOCK_DGRAM;
+      host += 6;
+    }
+  else if (strncmp (host, "tcp://", 6) == 0)
+    {
+      host += 6;
+    }
+
+  client->socktype = wish.ai_socktype;
 
-  host = strdup (hostport);
   colon = strchr (host, ':');
   /* check for ipv6 */
   if (strrchr (host, ':') != colon)
@@ -45,9 +105,15 @@ opc_client_new (char   *hostport,
   if (client->addresses)
     success = 1;
 
-  free (host);
+  free (name);
   if (!success)
     {
+      free (client->packet);
+      free (client->iov);
+      free (client->msgs);
+      free (client->last);
+      free (client->dirty);
+      free (client->channels);
       free (client);
       client = NULL;
     }
@@ -56,120 +122,921 @@ opc_client_new (char   *hostport,
 }
 
 
+/* (re)builds the packet buffer: one 4 byte header per channel followed
+ * by the quantized framebuffer.  The headers point into the payload via
+ * the iovecs assembled in opc_client_send_packet () */
+static int
+opc_client_layout (OpcClient *client)
+{
+  uint8_t *packet;
+  struct iovec *iov;
+  int i;
+
+  struct mmsghdr *msgs;
+  uint8_t *last;
+  int *dirty;
+  int size;
+
+  size = 4 * client->n_channels + client->fb_size * sizeof (uint8_t);
+
+  packet = realloc (client->packet, size);
+  last = realloc (client->last, size);
+  iov = realloc (client->iov, 2 * client->n_channels * sizeof (struct iovec));
+  msgs = realloc (client->msgs, client->n_channels * sizeof (struct mmsghdr));
+  dirty = realloc (client->dirty, client->n_channels * sizeof (int));
+
+  if (packet)
+    client->packet = packet;
+  if (last)
+    client->last = last;
+  if (iov)
+    client->iov = iov;
+  if (msgs)
+    client->msgs = msgs;
+  if (dirty)
+    client->dirty = dirty;
+
+  if (!packet || !last || !iov || !msgs || !dirty)
+    {
+      perror ("realloc");
+      return 0;
+    }
+
+  client->packet_size = size;
+
+  /* whatever the server has, it is not this layout */
+  client->force_full = 1;
+
+  /* channel and length fields only change with the layout */
+  for (i = 0; i < client->n_channels; i++)
+    {
+      client->packet[4 * i] = client->channels[i].channel;
+      client->packet[4 * i + 2] = client->channels[i].length >> 8;
+      client->packet[4 * i + 3] = client->channels[i].length & 0xff;
+    }
+
+  return 1;
+}
+
+
+/* the datagram limit in effect, see the mtu field */
+static int
+opc_client_mtu (OpcClient *client)
+{
+  if (client->mtu > 0)
+    return client->mtu;
+
+  return client->custom_channels ? OPC_ETHERNET_MTU : OPC_DEFAULT_MTU;
+}
+
+
+/* 0 goes back to the default for the channel map */
 int
-opc_client_connect (OpcClient *client)
+opc_client_set_mtu (OpcClient *client,
+                    int        mtu)
+{
+  if (client->async)
+    {
+      fprintf (stderr, "can't change the MTU in async mode\n");
+      return 0;
+    }
+
+  if (mtu != 0 && mtu < 4)
+    {
+      fprintf (stderr, "invalid MTU %d\n", mtu);
+      return 0;
+    }
+
+  client->mtu = mtu;
+
+  return 1;
+}
+
+
+int
+opc_client_set_keepalive (OpcClient *client,
+                          double     interval)
+{
+  if (client->async)
+    {
+      fprintf (stderr, "can't change the keep-alive in async mode\n");
+      return 0;
+    }
+
+  client->keepalive = interval;
+
+  return 1;
+}
+
+
+int
+opc_client_set_framebuffer (OpcClient *client,
+                            int        fb_size,
+                            pixel_t   *framebuffer)
+{
+  int i;
+
+  if (fb_size < 0)
+    {
+      fprintf (stderr, "invalid framebuffer size %d\n", fb_size);
+      return 0;
+    }
+
+  for (i = 0; client->custom_channels && i < client->n_channels; i++)
+    {
+      if (client->channels[i].offset + client->channels[i].length > fb_size)
+        {
+          fprintf (stderr, "framebuffer size %d too small for channel %d\n",
+                   fb_size, client->channels[i].channel);
+          return 0;
+        }
+    }
+
+  if (client->async && fb_size != client->fb_size)
+    {
+      fprintf (stderr, "can't resize the framebuffer in async mode\n");
+      return 0;
+    }
+
+  client->framebuffer = framebuffer;
+
+  if (!client->packet || fb_size != client->fb_size)
+    {
+      client->fb_size = fb_size;
+
+      if (!client->custom_channels)
+        {
+          client->n_channels = 1;
+          client->channels[0].channel = 0;
+          client->channels[0].offset = 0;
+          client->channels[0].length = fb_size;
+        }
+
+      return opc_client_layout (client);
+    }
+
+  return 1;
+}
+
+
+int
+opc_client_add_channel (OpcClient *client,
+                        uint8_t    channel,
+                        int        offset,
+                        int        length)
+{
+  OpcChannel *channels;
+  int n_channels;
+
+  if (client->async)
+    {
+      fprintf (stderr, "can't change the channel map in async mode\n");
+      return 0;
+    }
+
+  if (offset < 0 || length < 0 || length > 0xffff ||
+      offset + length > client->fb_size)
+    {
+      fprintf (stderr, "invalid slice %d+%d for channel %d\n",
+               offset, length, channel);
+      return 0;
+    }
+
+  /* the first custom channel replaces the default one, but only once
+   * there is room for it: a failure leaves the old map intact */
+  n_channels = client->custom_channels ? client->n_channels : 0;
+
+  channels = realloc (client->channels,
+                      (n_channels + 1) * sizeof (OpcChannel));
+  if (!channels)
+    {
+      perror ("realloc");
+      return 0;
+    }
+
+  client->channels = channels;
+  client->n_channels = n_channels;
+  client->channels[client->n_channels].channel = channel;
+  client->channels[client->n_channels].offset = offset;
+  client->channels[client->n_channels].length = length;
+  client->n_channels++;
+  client->custom_channels = 1;
+
+  return opc_client_layout (client);
+}
+
+
+int
+opc_client_clear_channels (OpcClient *client)
+{
+  int fb_size;
+
+  if (client->async)
+    {
+      fprintf (stderr, "can't change the channel map in async mode\n");
+      return 0;
+    }
+
+  fb_size = client->fb_size;
+  if (fb_size > 0xffff)
+    {
+      fprintf (stderr, "framebuffer too big for a single channel\n");
+      return 0;
+    }
+
+  client->custom_channels = 0;
+  client->fb_size = -1;  /* forces a new layout */
+
+  return opc_client_set_framebuffer (client, fb_size, client->framebuffer);
+}
+
+
+static void
+opc_client_schedule_reconnect (OpcClient *client)
+{
+  client->next_attempt = monotonic_now () + client->backoff;
+  client->backoff = client->backoff * 2 < OPC_BACKOFF_MAX ?
+                    client->backoff * 2 : OPC_BACKOFF_MAX;
+}
+
+
+static void
+opc_client_connected (OpcClient *client)
 {
   int flag;
-  struct addrinfo *info;
 
-  while (client->fd < 0)
+  client->fd = client->pending_fd;
+  client->pending_fd = -1;
+  client->current = NULL;
+  client->backoff = OPC_BACKOFF_MIN;
+
+  /* a fresh connection might be a fresh server */
+  client->force_full = 1;
+
+  if (client->socktype == SOCK_STREAM)
     {
-      for (info = client->addresses; info; info = info->ai_next)
+      flag = 1;
+      setsockopt (client->fd,
+                  IPPROTO_TCP,
+                  TCP_NODELAY,
+                  (char *) &flag,
+                  sizeof (flag));
+    }
+  else
+    {
+      int mtu = opc_client_mtu (client);
+      int i, n_big = 0;
+
+      for (i = 0; i < client->n_channels; i++)
         {
-          client->fd = socket (info->ai_family,
-                               info->ai_socktype,
-                               info->ai_protocol);
+          if (4 + client->channels[i].length > mtu)
+            n_big++;
+        }
 
-          if (client->fd >= 0)
-            {
-              if (connect (client->fd,
-                           info->ai_addr,
-                           info->ai_addrlen) < 0)
-                {
-                  perror ("connect");
-                }
-              else
-                {
-                  break;
-                }
+      if (n_big > 0)
+        fprintf (stderr, "%d of %d channels exceed the MTU of %d bytes, "
+                 "they will get fragmented\n",
+                 n_big, client->n_channels, mtu);
+    }
 
-              close (client->fd);
-              client->fd = -1;
-            }
-          else
-            {
-              perror ("socket");
-            }
+  /* only the async sender can cope with a non-blocking socket */
+  if (!client->async)
+    fcntl (client->fd, F_SETFL, fcntl (client->fd, F_GETFL) & ~O_NONBLOCK);
+
+  fprintf (stderr, "connected\n");
+}
+
+
+/* starts a non-blocking connect () to client->current, falls through to
+ * the following addresses on immediate failure */
+static void
+opc_client_try_address (OpcClient *client)
+{
+  for (; client->current; client->current = client->current->ai_next)
+    {
+      struct addrinfo *info = client->current;
+      int fd;
+
+      fd = socket (info->ai_family,
+                   info->ai_socktype | SOCK_NONBLOCK,
+                   info->ai_protocol);
+
+      if (fd < 0)
+        {
+          perror ("socket");
+          continue;
         }
 
-      if (client->fd < 0)
+      client->pending_fd = fd;
+
+      if (connect (fd, info->ai_addr, info->ai_addrlen) == 0)
         {
-          sleep (1);
+          opc_client_connected (client);
+          return;
         }
+
+      if (errno == EINPROGRESS)
+        return;
+
+      perror ("connect");
+      close (fd);
+      client->pending_fd = -1;
     }
 
-  flag = 1;
-  setsockopt (client->fd,
-              IPPROTO_TCP,
-              TCP_NODELAY,
-              (char *) &flag,
-              sizeof (flag));
+  /* ran out of addresses */
+  opc_client_schedule_reconnect (client);
+}
 
-  signal (SIGPIPE, SIG_IGN);
 
-  return 1;
+/* advances the connection state machine without ever blocking.
+ * Returns whether the client is connected. */
+static int
+opc_client_check_connection (OpcClient *client)
+{
+  if (client->fd >= 0)
+    return 1;
+
+  if (!atomic_load (&client->reconnect))
+    return 0;
+
+  if (client->pending_fd >= 0)
+    {
+      struct pollfd pfd = { client->pending_fd, POLLOUT, 0 };
+      socklen_t len;
+      int err;
+
+      /* connect still in progress? */
+      if (poll (&pfd, 1, 0) <= 0)
+        return 0;
+
+      err = 0;
+      len = sizeof (err);
+      getsockopt (client->pending_fd, SOL_SOCKET, SO_ERROR, &err, &len);
+
+      if (err == 0)
+        {
+          opc_client_connected (client);
+          return 1;
+        }
+
+      fprintf (stderr, "connect: %s\n", strerror (err));
+      close (client->pending_fd);
+      client->pending_fd = -1;
+
+      client->current = client->current->ai_next;
+      opc_client_try_address (client);
+    }
+  else if (monotonic_now () >= client->next_attempt)
+    {
+      client->current = client->addresses;
+      opc_client_try_address (client);
+    }
+
+  return client->fd >= 0;
+}
+
+
+/* drops a broken connection, the state machine picks it up again */
+static void
+opc_client_disconnect (OpcClient *client)
+{
+  close (client->fd);
+  client->fd = -1;
+
+  opc_client_schedule_reconnect (client);
 }
 
 
 int
-opc_client_write (OpcClient *client,
-                  uint8_t channel,
-                  uint8_t command)
+opc_client_connect (OpcClient *client)
 {
-  int length = 4 + client->fb_size * sizeof (uint8_t);
-  uint8_t *buffer;
-  uint8_t *data;
-  int i;
+  uint64_t one = 1;
+
+  signal (SIGPIPE, SIG_IGN);
+
+  atomic_store (&client->reconnect, 1);
+
+  /* in async mode the sender thread owns the connection */
+  if (client->async)
+    {
+      if (write (client->wakeup_fd, &one, sizeof (one)) < 0)
+        perror ("write");
+
+      return 0;
+    }
+
+  return opc_client_check_connection (client);
+}
 
-  if (client->fd < 0)
-    return 0;
 
-  buffer = malloc (length);
+/* the payload is either quantized from the framebuffer or, with raw
+ * != NULL, fb_size bytes that are ready to go out as they are */
+static void
+opc_client_fill_packet (OpcClient     *client,
+                        uint8_t       *packet,
+                        const uint8_t *raw,
+                        uint8_t        channel,
+                        uint8_t        command)
+{
+  int i;
 
-  buffer[0] = command;
-  buffer[1] = channel;
-  buffer[2] = (length - 4) >> 8;
-  buffer[3] = (length - 4) & 0xff;
+  for (i = 0; i < client->n_channels; i++)
+    packet[4 * i + 1] = command;
 
-  for (i = 0; i < client->fb_size; i++)
+  if (!client->custom_channels)
+    packet[0] = channel;
+
+  if (raw)
     {
-      buffer[i + 4] = (uint8_t) (client->framebuffer[i] * 255.0);
+      memcpy (packet + 4 * client->n_channels, raw, client->fb_size);
     }
+  else
+    {
+      double t0 = monotonic_now ();
+
+      opc_quantize (packet + 4 * client->n_channels,
+                    client->framebuffer, client->fb_size);
+      histogram_record (&client->quantize_time, monotonic_now () - t0);
+    }
+}
 
-  data = (uint8_t *) buffer;
 
-  while (length > 0)
+/* fire and forget: the channel packets get packed into as few datagrams
+ * as the MTU allows and go out with a single sendmmsg (), whatever does
+ * not fit the socket buffer gets dropped instead of delaying the next
+ * frame */
+static int
+opc_client_send_datagrams (OpcClient *client,
+                           int        n_iov)
+{
+  struct mmsghdr *msgs = client->msgs;
+  int mtu = opc_client_mtu (client);
+  int n_msgs = 0, sent = 0;
+  int size = 0;
+  int i;
+
+  for (i = 0; i < n_iov; i += 2)
+    {
+      int length = 4 + client->iov[i + 1].iov_len;
+
+      /* a channel packet never gets split, OPC has no offset field */
+      if (n_msgs == 0 || size + length > mtu)
+        {
+          memset (&msgs[n_msgs], 0, sizeof (struct mmsghdr));
+          msgs[n_msgs].msg_hdr.msg_iov = client->iov + i;
+          n_msgs++;
+          size = 0;
+        }
+
+      msgs[n_msgs - 1].msg_hdr.msg_iovlen += 2;
+      size += length;
+    }
+
+  while (sent < n_msgs)
     {
       int res;
 
-      res = send (client->fd, data, length, 0);
+      res = sendmmsg (client->fd, msgs + sent, n_msgs - sent, MSG_DONTWAIT);
       if (res < 0)
         {
-          perror ("send");
-          opc_client_shutdown (client);
+          if (errno == EINTR)
+            continue;
+
+          /* the socket buffer is full or the peer is not listening
+           * (yet), neither is worth a reconnect */
+          if (errno != EAGAIN && errno != EWOULDBLOCK &&
+              errno != ECONNREFUSED)
+            perror ("sendmmsg");
+
           return 0;
         }
 
-      length -= res;
-      data += length;
+      sent += res;
+    }
+
+  return 1;
+}
+
+
+static int
+opc_client_send_stream (OpcClient *client,
+                        int        n_iov)
+{
+  struct iovec *iov = client->iov;
+  int partial = 0;
+
+  while (n_iov > 0)
+    {
+      ssize_t res;
+
+      res = writev (client->fd, iov, n_iov);
+      if (res < 0)
+        {
+          if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+              struct pollfd pfd = { client->fd, POLLOUT, 0 };
+
+              /* wake up regularly to notice a stop request.  Half a
+               * packet on the stream would garble every later frame,
+               * the next connection starts a clean one. */
+              if (!atomic_load (&client->running))
+                {
+                  if (partial)
+                    opc_client_disconnect (client);
+                  return 0;
+                }
+
+              poll (&pfd, 1, 100);
+              continue;
+            }
+
+          if (errno == EINTR)
+            continue;
+
+          perror ("writev");
+          opc_client_disconnect (client);
+          return 0;
+        }
+
+      if (res > 0)
+        partial = 1;
+
+      /* skip over what made it out */
+      while (n_iov > 0 && res >= (ssize_t) iov->iov_len)
+        {
+          res -= iov->iov_len;
+          iov++;
+          n_iov--;
+        }
+
+      if (n_iov > 0)
+        {
+          iov->iov_base = (uint8_t *) iov->iov_base + res;
+          iov->iov_len -= res;
+        }
+    }
+
+  return 1;
+}
+
+
+/* sends the channel packets that changed since the last frame that made
+ * it out, all of them when the keep-alive interval expired.  They go out
+ * with a single writev () (or sendmmsg () for UDP), the headers and the
+ * payload slices are gathered straight from the packet buffer. */
+static int
+opc_client_send_packet (OpcClient *client,
+                        uint8_t   *packet)
+{
+  struct iovec *iov = client->iov;
+  uint8_t *payload = packet + 4 * client->n_channels;
+  uint8_t *last_payload = client->last + 4 * client->n_channels;
+  unsigned long bytes = 0, saved = 0;
+  int n_dirty = 0;
+  int full, res;
+  double now;
+  int i;
+
+  now = monotonic_now ();
+  full = client->force_full ||
+         client->keepalive <= 0 ||
+         now - client->last_full >= client->keepalive;
+
+  for (i = 0; i < client->n_channels; i++)
+    {
+      OpcChannel *ch = &client->channels[i];
+
+      if (!full &&
+          memcmp (packet + 4 * i, client->last + 4 * i, 4) == 0 &&
+          memcmp (payload + ch->offset, last_payload + ch->offset,
+                  ch->length) == 0)
+        {
+          saved += 4 + ch->length;
+          continue;
+        }
+
+      iov[2 * n_dirty].iov_base = packet + 4 * i;
+      iov[2 * n_dirty].iov_len = 4;
+      iov[2 * n_dirty + 1].iov_base = payload + ch->offset;
+      iov[2 * n_dirty + 1].iov_len = ch->length;
+      client->dirty[n_dirty] = i;
+      bytes += 4 + ch->length;
+      n_dirty++;
+    }
+
+  atomic_fetch_add (&client->bytes_saved, saved);
+
+  if (n_dirty == 0)
+    {
+      atomic_fetch_add (&client->frames_skipped, 1);
+      return 1;
+    }
+
+  if (client->socktype == SOCK_DGRAM)
+    res = opc_client_send_datagrams (client, 2 * n_dirty);
+  else
+    res = opc_client_send_stream (client, 2 * n_dirty);
+
+  histogram_record (&client->send_time, monotonic_now () - now);
+
+  if (!res)
+    {
+      atomic_fetch_add (&client->frames_dropped, 1);
+      return 0;
     }
 
-  free (buffer);
+  /* remember what the server has now */
+  for (i = 0; i < n_dirty; i++)
+    {
+      OpcChannel *ch = &client->channels[client->dirty[i]];
+
+      memcpy (client->last + 4 * client->dirty[i],
+              packet + 4 * client->dirty[i], 4);
+      memcpy (last_payload + ch->offset, payload + ch->offset, ch->length);
+    }
+
+  if (full)
+    {
+      client->last_full = now;
+      client->force_full = 0;
+    }
+
+  atomic_fetch_add (&client->frames_sent, 1);
+  atomic_fetch_add (&client->bytes_sent, bytes);
+
+  return 1;
+}
+
+
+static int
+opc_client_publish (OpcClient     *client,
+                    const uint8_t *raw,
+                    uint8_t        channel,
+                    uint8_t        command)
+{
+  uint64_t one = 1;
+  int prev;
+
+  opc_client_fill_packet (client, client->slots[client->back],
+                          raw, channel, command);
+
+  /* hand the finished frame to the sender, take the stale one back */
+  prev = atomic_exchange (&client->mailbox, client->back | SLOT_FRESH);
+  client->back = prev & ~SLOT_FRESH;
+
+  atomic_fetch_add (&client->frames_published, 1);
+
+  /* the sender never saw the previous frame, it gets replaced */
+  if (prev & SLOT_FRESH)
+    atomic_fetch_add (&client->frames_dropped, 1);
+
+  if (write (client->wakeup_fd, &one, sizeof (one)) < 0)
+    perror ("write");
+
   return 1;
 }
 
 
+static void *
+opc_client_sender_thread (void *data)
+{
+  OpcClient *client = data;
+  struct pollfd pfd = { client->wakeup_fd, POLLIN, 0 };
+
+  while (atomic_load (&client->running))
+    {
+      uint64_t count;
+      int connected;
+      int slot;
+
+      connected = opc_client_check_connection (client);
+
+      /* keep the connection state machine ticking while disconnected */
+      if (poll (&pfd, 1, connected ? -1 : OPC_CONNECT_POLL_MS) < 0)
+        {
+          if (errno == EINTR)
+            continue;
+
+          perror ("poll");
+          break;
+        }
+
+      if (read (client->wakeup_fd, &count, sizeof (count)) < 0 &&
+          errno != EAGAIN)
+        {
+          perror ("read");
+          break;
+        }
+
+      if (!(atomic_load (&client->mailbox) & SLOT_FRESH))
+        continue;
+
+      slot = atomic_exchange (&client->mailbox, client->front);
+      client->front = slot & ~SLOT_FRESH;
+
+      if (opc_client_check_connection (client))
+        opc_client_send_packet (client, client->slots[client->front]);
+      else
+        atomic_fetch_add (&client->frames_dropped, 1);
+    }
+
+  return NULL;
+}
+
+
+int
+opc_client_start_async (OpcClient *client)
+{
+  int i;
+
+  if (client->async)
+    return 1;
+
+  for (i = 0; i < 3; i++)
+    {
+      client->slots[i] = calloc (1, client->packet_size);
+      if (!client->slots[i])
+        {
+          perror ("calloc");
+          goto fail;
+        }
+
+      /* copies the channel and length fields */
+      memcpy (client->slots[i], client->packet, 4 * client->n_channels);
+    }
+
+  client->wakeup_fd = eventfd (0, EFD_NONBLOCK);
+  if (client->wakeup_fd < 0)
+    {
+      perror ("eventfd");
+      goto fail;
+    }
+
+  /* the sender must never block on a stalled server */
+  if (client->fd >= 0)
+    fcntl (client->fd, F_SETFL, fcntl (client->fd, F_GETFL) | O_NONBLOCK);
+
+  client->back = 0;
+  client->front = 1;
+  atomic_store (&client->mailbox, 2);
+  atomic_store (&client->running, 1);
+  client->async = 1;
+
+  if (pthread_create (&client->thread, NULL,
+                      opc_client_sender_thread, client) != 0)
+    {
+      fprintf (stderr, "can't start the sender thread\n");
+      atomic_store (&client->running, 0);
+      client->async = 0;
+      close (client->wakeup_fd);
+      goto fail;
+    }
+
+  return 1;
+
+fail:
+  for (i = 0; i < 3; i++)
+    {
+      free (client->slots[i]);
+      client->slots[i] = NULL;
+    }
+
+  return 0;
+}
+
+
+void
+opc_client_stop_async (OpcClient *client)
+{
+  uint64_t one = 1;
+  int i;
+
+  if (!client->async)
+    return;
+
+  atomic_store (&client->running, 0);
+  if (write (client->wakeup_fd, &one, sizeof (one)) < 0)
+    perror ("write");
+
+  pthread_join (client->thread, NULL);
+  close (client->wakeup_fd);
+  client->wakeup_fd = -1;
+
+  for (i = 0; i < 3; i++)
+    {
+      free (client->slots[i]);
+      client->slots[i] = NULL;
+    }
+
+  if (client->fd >= 0)
+    fcntl (client->fd, F_SETFL, fcntl (client->fd, F_GETFL) & ~O_NONBLOCK);
+
+  client->async = 0;
+}
+
+
+void
+opc_client_get_stats (OpcClient      *client,
+                      OpcClientStats *stats)
+{
+  stats->frames_published = atomic_load (&client->frames_published);
+  stats->frames_sent      = atomic_load (&client->frames_sent);
+  stats->frames_dropped   = atomic_load (&client->frames_dropped);
+  stats->frames_skipped   = atomic_load (&client->frames_skipped);
+  stats->bytes_sent       = atomic_load (&client->bytes_sent);
+  stats->bytes_saved      = atomic_load (&client->bytes_saved);
+}
+
+
+static int
+opc_client_write_payload (OpcClient     *client,
+                          const uint8_t *raw,
+                          uint8_t        channel,
+                          uint8_t        command)
+{
+  /* a single OPC packet can't carry more, bigger framebuffers need a
+   * channel map */
+  if (!client->custom_channels && client->fb_size > 0xffff)
+    {
+      fprintf (stderr, "framebuffer too big for a single channel\n");
+      return 0;
+    }
+
+  if (client->async)
+    return opc_client_publish (client, raw, channel, command);
+
+  atomic_fetch_add (&client->frames_published, 1);
+
+  if (!opc_client_check_connection (client))
+    {
+      atomic_fetch_add (&client->frames_dropped, 1);
+      return 0;
+    }
+
+  opc_client_fill_packet (client, client->packet, raw, channel, command);
+
+  return opc_client_send_packet (client, client->packet);
+}
+
+
+int
+opc_client_write (OpcClient *client,
+                  uint8_t channel,
+                  uint8_t command)
+{
+  return opc_client_write_payload (client, NULL, channel, command);
+}
+
+
+/* sends fb_size bytes of already quantized 8 bit data instead of the
+ * framebuffer, laid out like the framebuffer and split into the same
+ * channels */
+int
+opc_client_write_raw (OpcClient     *client,
+                      const uint8_t *data,
+                      uint8_t        channel,
+                      uint8_t        command)
+{
+  return opc_client_write_payload (client, data, channel, command);
+}
+
+
 void
 opc_client_shutdown (OpcClient *client)
 {
+  opc_client_stop_async (client);
+
+  atomic_store (&client->reconnect, 0);
+
+  if (client->pending_fd >= 0)
+    {
+      close (client->pending_fd);
+      client->pending_fd = -1;
+    }
+
   if (client->fd >= 0)
     {
       close (client->fd);
       client->fd = -1;
     }
+}
+
+
+void
+opc_client_free (OpcClient *client)
+{
+  opc_client_shutdown (client);
 
   if (client->addresses)
     freeaddrinfo (client->addresses);
+
+  free (client->packet);
+  free (client->iov);
+  free (client->msgs);
+  free (client->last);
+  free (client->dirty);
+  free (client->channels);
+  free (client);
 }
 
 
@@ -1,25 +1,151 @@
 #ifndef __OPC_CLIENT_H__
 #define __OPC_CLIENT_H__
 
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "pixel-format.h"
+#include "histogram.h"
+
+/* UDP payload that fits an ethernet frame without IP fragmentation, the
+ * datagram limit with a channel map */
+#define OPC_ETHERNET_MTU 1472
+
+typedef struct
+{
+  uint8_t             channel;
+  int                 offset;
+  int                 length;
+} OpcChannel;
+
 struct _opc_client
 {
   int                 fd;
   struct addrinfo    *addresses;
+  int                 socktype;
+
+  /* non-blocking (re)connect: pending_fd is the socket of a connect ()
+   * in progress to the address "current".  When all addresses fail the
+   * next round starts at next_attempt, with exponential backoff. */
+  atomic_int          reconnect;
+  int                 pending_fd;
+  struct addrinfo    *current;
+  double              next_attempt;
+  double              backoff;
+
   int                 fb_size;
-  double             *framebuffer;
+  pixel_t            *framebuffer;
+
+  /* framebuffer slices and the OPC channels they get sent on.  Without
+   * a custom map the whole framebuffer goes out on the channel passed
+   * to opc_client_write () */
+  OpcChannel         *channels;
+  int                 n_channels;
+  int                 custom_channels;
+
+  /* preallocated packet buffer (one 4 byte header per channel followed
+   * by fb_size data bytes), reused for every frame */
+  uint8_t            *packet;
+  int                 packet_size;
+  struct iovec       *iov;
+
+  /* UDP only: the channel packets get packed into datagrams of at most
+   * mtu bytes.  0 picks OPC_ETHERNET_MTU with a channel map, and as big
+   * as UDP allows for the single default channel. */
+  int                 mtu;
+  struct mmsghdr     *msgs;
+
+  /* delta suppression: last holds the packet the server got last, only
+   * channels that differ from it get sent.  Everything gets resent
+   * after keepalive seconds (<= 0 disables the suppression). */
+  uint8_t            *last;
+  int                *dirty;
+  double              keepalive;
+  double              last_full;
+  int                 force_full;
+
+  /* asynchronous sender: the render loop fills slots[back] and swaps it
+   * into the single-slot mailbox, the sender thread swaps the newest
+   * frame out into slots[front].  A frame that gets replaced in the
+   * mailbox before the sender picks it up is dropped. */
+  int                 async;
+  pthread_t           thread;
+  atomic_int          running;
+  int                 wakeup_fd;
+  uint8_t            *slots[3];
+  int                 back;
+  int                 front;
+  atomic_int          mailbox;
+
+  atomic_ulong        frames_published;
+  atomic_ulong        frames_sent;
+  atomic_ulong        frames_dropped;
+  atomic_ulong        frames_skipped;
+  atomic_ulong        bytes_sent;
+  atomic_ulong        bytes_saved;
+
+  /* how long quantizing a frame and sending it took.  In async mode
+   * the sender thread records the send times. */
+  Histogram           quantize_time;
+  Histogram           send_time;
 };
 
 typedef struct _opc_client OpcClient;
 
+typedef struct
+{
+  unsigned long frames_published;
+  unsigned long frames_sent;
+  unsigned long frames_dropped;
+  unsigned long frames_skipped;
+  unsigned long bytes_sent;
+  unsigned long bytes_saved;
+} OpcClientStats;
+
+typedef enum
+{
+  OPC_QUANTIZE_AUTO,
+  OPC_QUANTIZE_SCALAR,
+  OPC_QUANTIZE_SSE2,
+  OPC_QUANTIZE_AVX2,
+} OpcQuantizeImpl;
+
+
+OpcClient * opc_client_new             (char    *hostport,
+                                        int      default_port,
+                                        int      fb_size,
+                                        pixel_t *framebuffer);
+int         opc_client_set_framebuffer (OpcClient *client,
+                                        int        fb_size,
+                                        pixel_t   *framebuffer);
+int         opc_client_add_channel     (OpcClient *client,
+                                        uint8_t    channel,
+                                        int        offset,
+                                        int        length);
+int         opc_client_clear_channels  (OpcClient *client);
+int         opc_client_set_mtu         (OpcClient *client,
+                                        int        mtu);
+int         opc_client_set_keepalive   (OpcClient *client,
+                                        double     interval);
+int         opc_client_connect         (OpcClient *client);
+int         opc_client_write           (OpcClient *client,
+                                        uint8_t channel,
+                                        uint8_t command);
+int         opc_client_write_raw       (OpcClient     *client,
+                                        const uint8_t *data,
+                                        uint8_t        channel,
+                                        uint8_t        command);
+int         opc_client_start_async     (OpcClient *client);
+void        opc_client_stop_async      (OpcClient *client);
+void        opc_client_get_stats       (OpcClient      *client,
+                                        OpcClientStats *stats);
+void        opc_client_shutdown        (OpcClient *client);
+void        opc_client_free            (OpcClient *client);
 
-OpcClient * opc_client_new      (char   *hostport,
-                                 int     default_port,
-                                 int     fb_size,
-                                 double *framebuffer);
-int         opc_client_connect  (OpcClient *client);
-int         opc_client_write    (OpcClient *client,
-                                 uint8_t channel,
-                                 uint8_t command);
-void        opc_client_shutdown (OpcClient *client);
+int         opc_quantize_set_impl      (OpcQuantizeImpl impl);
+void        opc_quantize               (uint8_t       *dst,
+                                        const pixel_t *src,
+                                        int            n);
 
 #endif
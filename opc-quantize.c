@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#if defined (__x86_64__) || defined (__i386__)
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+#include "opc-client.h"
+
+/*
+ * Conversion of the framebuffer to the 8 bit OPC payload.
+ *
+ * All implementations compute exactly the same thing: clamp to [0, 1],
+ * scale to [0, 255] and round to nearest.  For the floating point
+ * formats the clamping order matches the semantics of the SSE min/max
+ * instructions, so NaN maps to 0 in every implementation and the
+ * outputs are bit-identical.  The fixed point format is in range by
+ * construction and divides by 257 (65535 / 255).
+ */
+
+typedef void (*QuantizeFunc) (uint8_t *, const pixel_t *, int);
+
+
+static void
+quantize_scalar (uint8_t       *dst,
+                 const pixel_t *src,
+                 int            n)
+{
+  int i;
+
+  for (i = 0; i < n; i++)
+    {
+#if defined (PIXEL_FORMAT_U16)
+      dst[i] = (src[i] + 128) / 257;
+#elif defined (PIXEL_FORMAT_FLOAT)
+      float v = src[i];
+
+      v = v > 0.0f ? v : 0.0f;
+      v = v < 1.0f ? v : 1.0f;
+
+      dst[i] = (uint8_t) (v * 255.0f + 0.5f);
+#else
+      double v = src[i];
+
+      v = v > 0.0 ? v : 0.0;
+      v = v < 1.0 ? v : 1.0;
+
+      dst[i] = (uint8_t) (v * 255.0 + 0.5);
+#endif
+    }
+}
+
+
+#ifdef HAVE_X86_SIMD
+
+#if defined (PIXEL_FORMAT_U16)
+
+/* (x + 128) / 257 for all 16 bit x: the addition saturates, which does
+ * not change the result, and the division is a multiply by
+ * ceil (2^24 / 257) */
+#define QUANTIZE_U16_SSE2(v) \
+  _mm_srli_epi16 (_mm_mulhi_epu16 (_mm_adds_epu16 ((v), _mm_set1_epi16 (128)), \
+                                   _mm_set1_epi16 ((short) 65281)), 8)
+
+__attribute__ ((target ("sse2")))
+static void
+quantize_sse2 (uint8_t       *dst,
+               const pixel_t *src,
+               int            n)
+{
+  int i;
+
+  for (i = 0; i + 16 <= n; i += 16)
+    {
+      __m128i a, b;
+
+      a = QUANTIZE_U16_SSE2 (_mm_loadu_si128 ((const __m128i *) (src + i)));
+      b = QUANTIZE_U16_SSE2 (_mm_loadu_si128 ((const __m128i *) (src + i + 8)));
+
+      _mm_storeu_si128 ((__m128i *) (dst + i), _mm_packus_epi16 (a, b));
+    }
+
+  quantize_scalar (dst + i, src + i, n - i);
+}
+
+
+__attribute__ ((target ("avx2")))
+static void
+quantize_avx2 (uint8_t       *dst,
+               const pixel_t *src,
+               int            n)
+{
+  const __m256i bias = _mm256_set1_epi16 (128);
+  const __m256i mult = _mm256_set1_epi16 ((short) 65281);
+  int i;
+
+  for (i = 0; i + 32 <= n; i += 32)
+    {
+      __m256i a, b;
+
+      a = _mm256_loadu_si256 ((const __m256i *) (src + i));
+      b = _mm256_loadu_si256 ((const __m256i *) (src + i + 16));
+      a = _mm256_srli_epi16 (_mm256_mulhi_epu16 (_mm256_adds_epu16 (a, bias), mult), 8);
+      b = _mm256_srli_epi16 (_mm256_mulhi_epu16 (_mm256_adds_epu16 (b, bias), mult), 8);
+
+      /* packus works per 128 bit lane, restore the order afterwards */
+      _mm256_storeu_si256 ((__m256i *) (dst + i),
+                           _mm256_permute4x64_epi64 (_mm256_packus_epi16 (a, b),
+                                                     0xd8));
+    }
+
+  quantize_scalar (dst + i, src + i, n - i);
+}
+
+#elif defined (PIXEL_FORMAT_FLOAT)
+
+__attribute__ ((target ("sse2")))
+static void
+quantize_sse2 (uint8_t       *dst,
+               const pixel_t *src,
+               int            n)
+{
+  const __m128 zero  = _mm_setzero_ps ();
+  const __m128 one   = _mm_set1_ps (1.0f);
+  const __m128 scale = _mm_set1_ps (255.0f);
+  const __m128 half  = _mm_set1_ps (0.5f);
+  int i;
+
+#define QUANTIZE4(p) \
+  _mm_cvttps_epi32 (_mm_add_ps (_mm_mul_ps (_mm_min_ps (_mm_max_ps (_mm_loadu_ps (p), zero), one), scale), half))
+
+  for (i = 0; i + 16 <= n; i += 16)
+    {
+      __m128i a, b, c, d;
+
+      a = QUANTIZE4 (src + i + 0);
+      b = QUANTIZE4 (src + i + 4);
+      c = QUANTIZE4 (src + i + 8);
+      d = QUANTIZE4 (src + i + 12);
+
+      _mm_storeu_si128 ((__m128i *) (dst + i),
+                        _mm_packus_epi16 (_mm_packs_epi32 (a, b),
+                                          _mm_packs_epi32 (c, d)));
+    }
+
+#undef QUANTIZE4
+
+  quantize_scalar (dst + i, src + i, n - i);
+}
+
+
+__attribute__ ((target ("avx2")))
+static void
+quantize_avx2 (uint8_t       *dst,
+               const pixel_t *src,
+               int            n)
+{
+  const __m256 zero  = _mm256_setzero_ps ();
+  const __m256 one   = _mm256_set1_ps (1.0f);
+  const __m256 scale = _mm256_set1_ps (255.0f);
+  const __m256 half  = _mm256_set1_ps (0.5f);
+  int i;
+
+#define QUANTIZE8(p) \
+  _mm256_cvttps_epi32 (_mm256_add_ps (_mm256_mul_ps (_mm256_min_ps (_mm256_max_ps (_mm256_loadu_ps (p), zero), one), scale), half))
+
+  for (i = 0; i + 32 <= n; i += 32)
+    {
+      __m256i a, b, c, d, w;
+
+      a = QUANTIZE8 (src + i + 0);
+      b = QUANTIZE8 (src + i + 8);
+      c = QUANTIZE8 (src + i + 16);
+      d = QUANTIZE8 (src + i + 24);
+
+      /* the packs work per 128 bit lane, restore the order afterwards */
+      w = _mm256_packus_epi16 (_mm256_packs_epi32 (a, b),
+                               _mm256_packs_epi32 (c, d));
+      w = _mm256_permutevar8x32_epi32 (w, _mm256_setr_epi32 (0, 4, 1, 5,
+                                                             2, 6, 3, 7));
+      _mm256_storeu_si256 ((__m256i *) (dst + i), w);
+    }
+
+#undef QUANTIZE8
+
+  quantize_scalar (dst + i, src + i, n - i);
+}
+
+#else
+
+__attribute__ ((target ("sse2")))
+static void
+quantize_sse2 (uint8_t       *dst,
+               const pixel_t *src,
+               int            n)
+{
+  const __m128d zero  = _mm_setzero_pd ();
+  const __m128d one   = _mm_set1_pd (1.0);
+  const __m128d scale = _mm_set1_pd (255.0);
+  const __m128d half  = _mm_set1_pd (0.5);
+  int i;
+
+#define QUANTIZE2(p) \
+  _mm_cvttpd_epi32 (_mm_add_pd (_mm_mul_pd (_mm_min_pd (_mm_max_pd (_mm_loadu_pd (p), zero), one), scale), half))
+
+  for (i = 0; i + 8 <= n; i += 8)
+    {
+      __m128i a, b, c, d, w;
+
+      /* each conversion yields two int32 in the low half */
+      a = QUANTIZE2 (src + i + 0);
+      b = QUANTIZE2 (src + i + 2);
+      c = QUANTIZE2 (src + i + 4);
+      d = QUANTIZE2 (src + i + 6);
+
+      w = _mm_packs_epi32 (_mm_unpacklo_epi64 (a, b),
+                           _mm_unpacklo_epi64 (c, d));
+      _mm_storel_epi64 ((__m128i *) (dst + i), _mm_packus_epi16 (w, w));
+    }
+
+#undef QUANTIZE2
+
+  quantize_scalar (dst + i, src + i, n - i);
+}
+
+
+__attribute__ ((target ("avx2")))
+static void
+quantize_avx2 (uint8_t       *dst,
+               const pixel_t *src,
+               int            n)
+{
+  const __m256d zero  = _mm256_setzero_pd ();
+  const __m256d one   = _mm256_set1_pd (1.0);
+  const __m256d scale = _mm256_set1_pd (255.0);
+  const __m256d half  = _mm256_set1_pd (0.5);
+  int i;
+
+#define QUANTIZE4(p) \
+  _mm256_cvttpd_epi32 (_mm256_add_pd (_mm256_mul_pd (_mm256_min_pd (_mm256_max_pd (_mm256_loadu_pd (p), zero), one), scale), half))
+
+  for (i = 0; i + 16 <= n; i += 16)
+    {
+      __m128i a, b, c, d;
+
+      a = QUANTIZE4 (src + i + 0);
+      b = QUANTIZE4 (src + i + 4);
+      c = QUANTIZE4 (src + i + 8);
+      d = QUANTIZE4 (src + i + 12);
+
+      _mm_storeu_si128 ((__m128i *) (dst + i),
+                        _mm_packus_epi16 (_mm_packs_epi32 (a, b),
+                                          _mm_packs_epi32 (c, d)));
+    }
+
+#undef QUANTIZE4
+
+  quantize_scalar (dst + i, src + i, n - i);
+}
+
+#endif
+
+#endif
+
+
+static QuantizeFunc
+quantize_lookup (OpcQuantizeImpl impl)
+{
+  switch (impl)
+    {
+      case OPC_QUANTIZE_SCALAR:
+        return quantize_scalar;
+
+#ifdef HAVE_X86_SIMD
+      case OPC_QUANTIZE_SSE2:
+        __builtin_cpu_init ();
+        return __builtin_cpu_supports ("sse2") ? quantize_sse2 : NULL;
+
+      case OPC_QUANTIZE_AVX2:
+        __builtin_cpu_init ();
+        return __builtin_cpu_supports ("avx2") ? quantize_avx2 : NULL;
+#endif
+
+      case OPC_QUANTIZE_AUTO:
+        {
+          QuantizeFunc func;
+
+          func = quantize_lookup (OPC_QUANTIZE_AVX2);
+          if (!func)
+            func = quantize_lookup (OPC_QUANTIZE_SSE2);
+          if (!func)
+            func = quantize_scalar;
+
+          return func;
+        }
+
+      default:
+        return NULL;
+    }
+}
+
+
+static QuantizeFunc quantize_func = NULL;
+
+
+int
+opc_quantize_set_impl (OpcQuantizeImpl impl)
+{
+  QuantizeFunc func;
+
+  func = quantize_lookup (impl);
+  if (!func)
+    return 0;
+
+  quantize_func = func;
+
+  return 1;
+}
+
+
+void
+opc_quantize (uint8_t       *dst,
+              const pixel_t *src,
+              int            n)
+{
+  if (!quantize_func)
+    quantize_func = quantize_lookup (OPC_QUANTIZE_AUTO);
+
+  quantize_func (dst, src, n);
+}
@@ -0,0 +1,54 @@
+#ifndef __PIXEL_FORMAT_H__
+#define __PIXEL_FORMAT_H__
+
+#include <stdint.h>
+
+/*
+ * Storage type of the framebuffer channels, selected at build time:
+ *
+ *   PIXEL_FORMAT_DOUBLE  double, 8 bytes per channel (default)
+ *   PIXEL_FORMAT_FLOAT   float, 4 bytes per channel
+ *   PIXEL_FORMAT_U16     unsigned 16 bit fixed point, 2 bytes per channel,
+ *                        0 .. 65535 maps to 0.0 .. 1.0
+ *
+ * The floating point formats can hold out-of-range values, they get
+ * clamped by the OPC quantizer.  The fixed point format clamps on store.
+ * Renderers compute in double and convert with PIXEL_FROM_DOUBLE () /
+ * PIXEL_TO_DOUBLE ().
+ */
+
+#if defined (PIXEL_FORMAT_FLOAT)
+
+typedef float pixel_t;
+
+#define PIXEL_FORMAT_NAME      "float"
+#define PIXEL_FROM_DOUBLE(v)   ((float) (v))
+#define PIXEL_TO_DOUBLE(p)     ((double) (p))
+
+#elif defined (PIXEL_FORMAT_U16)
+
+typedef uint16_t pixel_t;
+
+#define PIXEL_FORMAT_NAME      "u16"
+#define PIXEL_ONE              65535
+/* written so that NaN ends up as 0 */
+#define PIXEL_FROM_DOUBLE(v)   ((pixel_t) (!((v) > 0.0) ? 0 :                 \
+                                           (v) >= 1.0 ? PIXEL_ONE :           \
+                                           (v) * PIXEL_ONE + 0.5))
+#define PIXEL_TO_DOUBLE(p)     ((p) * (1.0 / PIXEL_ONE))
+
+#else
+
+#ifndef PIXEL_FORMAT_DOUBLE
+#define PIXEL_FORMAT_DOUBLE
+#endif
+
+typedef double pixel_t;
+
+#define PIXEL_FORMAT_NAME      "double"
+#define PIXEL_FROM_DOUBLE(v)   (v)
+#define PIXEL_TO_DOUBLE(p)     (p)
+
+#endif
+
+#endif
@@ -0,0 +1,672 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <netinet/in.h>
+
+#include "frame-scheduler.h"
+#include "opc-client.h"
+#include "render-utils.h"
+#include "image-cache.h"
+#include "sample-map.h"
+#include "compositor.h"
+#include "render-pool.h"
+#include "histogram.h"
+#include "renderer_ball.h"
+
+/*
+ * Throughput of the framebuffer kernels for the pixel format this
+ * binary got built with (see PIXEL_FORMAT in the Makefile).  Run the
+ * render-bench-* binaries side by side to compare the formats.
+ *
+ * Each cube size runs once with the specialised kernels and once more
+ * through the generic code path ("generic"), to keep an eye on what
+ * the runtime geometry costs.  Before that render_blob () gets checked
+ * against the straightforward pow () version, a mismatch makes the
+ * exit status non-zero.  Then the render pool has to scale from one
+ * thread to one per CPU (at least four), with the same output as
+ * rendering in one piece.  Last the stats histograms, their
+ * percentiles have to be within the bucket precision.
+ */
+
+
+static void
+report (const char         *geom_name,
+        const CubeGeometry *geom,
+        const char         *name,
+        double              t0,
+        double              t1,
+        int                 n_iter)
+{
+  printf ("%-8s %-16s %-18s %11.1f ns/call %7.3f ns/channel\n",
+          PIXEL_FORMAT_NAME, geom_name, name,
+          (t1 - t0) * 1000000000.0 / n_iter,
+          (t1 - t0) * 1000000000.0 / n_iter / geom->fb_size);
+}
+
+
+/* render_blob () as it was before the falloff table, the reference for
+ * check_blob () */
+static void
+render_blob_pow (pixel_t            *fb,
+                 const CubeGeometry *geom,
+                 double cx, double cy, double cz,
+                 double red, double green, double blue,
+                 double r, double s)
+{
+  int X, Y, Z;
+
+  for (X = 0; X < geom->size_x; X++)
+    {
+      for (Y = 0; Y < geom->size_y; Y++)
+        {
+          for (Z = 0; Z < geom->size_z; Z++)
+            {
+              double x = X * 2.0 / geom->size_x;
+              double y = Y * 2.0 / geom->size_y;
+              double z = Z * 2.0 / geom->size_z;
+              double d;
+
+              d = pow ((x - cx) * (x - cx) +
+                       (y - cy) * (y - cy) +
+                       (z - cz) * (z - cz), 0.5);
+
+              d /= r;
+              d = (d - 0.5) * s + 0.5;
+              d = CLAMP (d, 0.0, 1.0);
+
+              d = pow (d, s);
+
+              render_pixel (fb, geom, X, Y, Z, red, green, blue, 1.0 - d);
+            }
+        }
+    }
+}
+
+
+/* the table based render_blob () has to stay within one 8 bit step of
+ * the pow () version on the wire.  Returns the number of failed blobs. */
+static int
+check_blob (const char         *geom_name,
+            const CubeGeometry *geom,
+            int                 n_blobs)
+{
+  static const double sharpness[] = { 0.5, 1.0, 1.5, 3.0, 8.0 };
+  pixel_t *fb1, *fb2;
+  uint8_t *out1, *out2;
+  int i, j, max_diff = 0, n_failed = 0;
+
+  fb1 = framebuffer_new (geom);
+  fb2 = framebuffer_new (geom);
+  out1 = calloc (geom->fb_size, sizeof (uint8_t));
+  out2 = calloc (geom->fb_size, sizeof (uint8_t));
+
+  for (i = 0; i < n_blobs; i++)
+    {
+      double cx = drand48 () * 2.6 - 0.3;
+      double cy = drand48 () * 2.6 - 0.3;
+      double cz = drand48 () * 2.6 - 0.3;
+      double r = 0.05 + drand48 ();
+      double s = sharpness[i % 5];
+      int diff = 0;
+
+      for (j = 0; j < geom->fb_size; j++)
+        fb1[j] = fb2[j] = PIXEL_FROM_DOUBLE (drand48 ());
+
+      render_blob (fb1, geom, cx, cy, cz, 1.0, 0.5, 0.0, r, s);
+      render_blob_pow (fb2, geom, cx, cy, cz, 1.0, 0.5, 0.0, r, s);
+
+      opc_quantize (out1, fb1, geom->fb_size);
+      opc_quantize (out2, fb2, geom->fb_size);
+
+      for (j = 0; j < geom->fb_size; j++)
+        diff = MAX (diff, ABS (out1[j] - out2[j]));
+
+      max_diff = MAX (max_diff, diff);
+      if (diff > 1)
+        n_failed++;
+    }
+
+  printf ("%-8s %-16s render_blob against pow (): max %d steps, %s\n",
+          PIXEL_FORMAT_NAME, geom_name, max_diff,
+          n_failed ? "FAILED" : "ok");
+
+  framebuffer_free (fb1);
+  framebuffer_free (fb2);
+  free (out1);
+  free (out2);
+
+  return n_failed;
+}
+
+
+/* the crossfade of renderer-all, both layers repainted every frame,
+ * an overlay that changes on top of a background that doesn't, and a
+ * single layer that has to go out without a copy */
+static int
+bench_compositor (const char         *geom_name,
+                  const CubeGeometry *geom,
+                  int                 n_iter)
+{
+  Compositor *comp;
+  Layer *background, *overlay;
+  const pixel_t *frame = NULL;
+  pixel_t *fb;
+  double t0, t1;
+  int i, n_failed = 0;
+
+  comp = compositor_new (geom);
+  background = compositor_add_layer (comp, BLEND_OVER, 1.0);
+  overlay = compositor_add_layer (comp, BLEND_OVER, 0.5);
+  fb = framebuffer_new (geom);
+
+  for (i = 0; i < geom->fb_size; i++)
+    {
+      background->pixels[i] = PIXEL_FROM_DOUBLE (drand48 ());
+      overlay->pixels[i] = PIXEL_FROM_DOUBLE (drand48 ());
+    }
+
+  t0 = monotonic_now ();
+  for (i = 0; i < n_iter; i++)
+    {
+      layer_mark_dirty (background);
+      layer_mark_dirty (overlay);
+      compositor_render (comp, fb);
+    }
+  t1 = monotonic_now ();
+  report (geom_name, geom, "compositor fade", t0, t1, n_iter);
+
+  layer_set_blend_mode (overlay, BLEND_ADD);
+  compositor_render (comp, fb);
+
+  t0 = monotonic_now ();
+  for (i = 0; i < n_iter; i++)
+    {
+      layer_mark_dirty (overlay);
+      compositor_render (comp, fb);
+    }
+  t1 = monotonic_now ();
+  report (geom_name, geom, "compositor overlay", t0, t1, n_iter);
+
+  /* a single opaque layer is the frame itself, nothing to blend */
+  layer_set_visible (overlay, 0);
+
+  t0 = monotonic_now ();
+  for (i = 0; i < n_iter; i++)
+    {
+      layer_mark_dirty (background);
+      frame = compositor_render (comp, fb);
+    }
+  t1 = monotonic_now ();
+  report (geom_name, geom, "compositor single", t0, t1, n_iter);
+
+  if (frame != background->pixels)
+    {
+      fprintf (stderr, "%s: compositor copied a single layer\n", geom_name);
+      n_failed++;
+    }
+
+  framebuffer_free (fb);
+  compositor_free (comp);
+
+  return n_failed;
+}
+
+
+static int
+bench_geometry (const char         *geom_name,
+                const CubeGeometry *geom,
+                int                 n_iter)
+{
+  pixel_t *fb, *effect1, *effect2;
+  uint8_t *payload;
+  double t0, t1;
+  int i, x, y, z;
+
+  fb = framebuffer_new (geom);
+  effect1 = framebuffer_new (geom);
+  effect2 = framebuffer_new (geom);
+  payload = calloc (geom->fb_size, sizeof (uint8_t));
+
+  for (i = 0; i < geom->fb_size; i++)
+    {
+      effect1[i] = PIXEL_FROM_DOUBLE (drand48 ());
+      effect2[i] = PIXEL_FROM_DOUBLE (drand48 ());
+    }
+
+  printf ("%-8s %-16s %d bytes per framebuffer\n",
+          PIXEL_FORMAT_NAME, geom_name,
+          (int) (geom->fb_size * sizeof (pixel_t)));
+
+  t0 = monotonic_now ();
+  for (i = 0; i < n_iter; i++)
+    framebuffer_set (fb, geom, 0.1, 0.2, 0.3);
+  t1 = monotonic_now ();
+  report (geom_name, geom, "framebuffer_set", t0, t1, n_iter);
+
+  t0 = monotonic_now ();
+  for (i = 0; i < n_iter; i++)
+    framebuffer_dim (effect1, geom, 0.99999);
+  t1 = monotonic_now ();
+  report (geom_name, geom, "framebuffer_dim", t0, t1, n_iter);
+
+  t0 = monotonic_now ();
+  for (i = 0; i < n_iter; i++)
+    framebuffer_merge (fb, geom, effect1, effect2, (i % 100) / 100.0);
+  t1 = monotonic_now ();
+  report (geom_name, geom, "framebuffer_merge", t0, t1, n_iter);
+
+  t0 = monotonic_now ();
+  for (i = 0; i < n_iter / 10; i++)
+    {
+      for (x = 0; x < geom->size_x; x++)
+        for (y = 0; y < geom->size_y; y++)
+          for (z = 0; z < geom->size_z; z++)
+            render_pixel (fb, geom, x, y, z, 0.5, 0.5, 0.5, 0.5);
+    }
+  t1 = monotonic_now ();
+  report (geom_name, geom, "render_pixel", t0, t1, n_iter / 10);
+
+  t0 = monotonic_now ();
+  for (i = 0; i < n_iter / 10; i++)
+    render_blob (fb, geom, 0.875, 0.875, 0.875, 1.0, 1.0, 0.0, 0.75, 1.5);
+  t1 = monotonic_now ();
+  report (geom_name, geom, "render_blob", t0, t1, n_iter / 10);
+
+  t0 = monotonic_now ();
+  for (i = 0; i < n_iter / 10; i++)
+    render_blob_pow (fb, geom, 0.875, 0.875, 0.875, 1.0, 1.0, 0.0, 0.75, 1.5);
+  t1 = monotonic_now ();
+  report (geom_name, geom, "render_blob pow ()", t0, t1, n_iter / 10);
+
+  t0 = monotonic_now ();
+  for (i = 0; i < n_iter; i++)
+    opc_quantize (payload, fb, geom->fb_size);
+  t1 = monotonic_now ();
+  report (geom_name, geom, "opc_quantize", t0, t1, n_iter);
+
+  framebuffer_free (fb);
+  framebuffer_free (effect1);
+  framebuffer_free (effect2);
+  free (payload);
+
+  return bench_compositor (geom_name, geom, n_iter);
+}
+
+
+/* what mode_import_png () paid per frame before and after the cache */
+static void
+bench_image (const char *path,
+             int         n_iter)
+{
+  const Image *image;
+  double *pixels;
+  void *rows;
+  int width, height, rowstride;
+  double t0, t1;
+  int i;
+
+  image = image_cache_get (path);
+  if (!image)
+    return;
+  image_unref (image);
+
+  t0 = monotonic_now ();
+  for (i = 0; i < n_iter; i++)
+    {
+      if (read_png_file ((char *) path, &width, &height, &rowstride, &pixels) < 0)
+        return;
+      free (pixels);
+    }
+  t1 = monotonic_now ();
+
+  printf ("%-8s %-16s %-18s %11.1f ns/call\n",
+          PIXEL_FORMAT_NAME, path, "read_png_file",
+          (t1 - t0) * 1000000000.0 / n_iter);
+
+  t0 = monotonic_now ();
+  for (i = 0; i < n_iter; i++)
+    {
+      if (read_png_rows (path, IMAGE_FORMAT_U8, 0, -1,
+                         &width, &height, &rowstride, &rows) < 0)
+        return;
+      free (rows);
+    }
+  t1 = monotonic_now ();
+
+  printf ("%-8s %-16s %-18s %11.1f ns/call\n",
+          PIXEL_FORMAT_NAME, path, "read_png_rows u8",
+          (t1 - t0) * 1000000000.0 / n_iter);
+
+  t0 = monotonic_now ();
+  for (i = 0; i < n_iter; i++)
+    {
+      image = image_cache_get (path);
+      image_unref (image);
+    }
+  t1 = monotonic_now ();
+
+  printf ("%-8s %-16s %-18s %11.1f ns/call\n",
+          PIXEL_FORMAT_NAME, path, "image_cache_get",
+          (t1 - t0) * 1000000000.0 / n_iter);
+}
+
+
+/* projecting an image onto 512 points: sample_buffer_u8 () per point
+ * against the precomputed map, the same rotated view for both */
+static void
+bench_sample_map (const char *path,
+                  int         n_iter)
+{
+  SampleTransform transform = { 0.8, -0.6, 0.6, 0.8, 12.3, 14.7 };
+  const Image *image;
+  SampleMap *map;
+  pixel_t *out;
+  double sample[3], max_diff = 0.0;
+  double t0, t1;
+  int i, j, c;
+
+  image = image_cache_get (path);
+  if (!image)
+    return;
+
+  map = sample_map_new (512);
+  if (!map)
+    {
+      image_unref (image);
+      return;
+    }
+
+  out = calloc (512 * 3, sizeof (pixel_t));
+
+  for (j = 0; j < 512; j++)
+    sample_map_set_point (map, j, (j % 32) * 0.5 - 8, j / 32 - 8);
+
+  sample_map_update (map, &transform, image->width, image->height,
+                     image->rowstride);
+  sample_map_apply_u8 (map, image->pixels, out);
+
+  for (j = 0; j < 512; j++)
+    {
+      double u = map->points[j * 2 + 0], v = map->points[j * 2 + 1];
+
+      sample_buffer_u8 (image->pixels, image->width, image->height,
+                        image->rowstride,
+                        transform.xx * u + transform.xy * v + transform.x0,
+                        transform.yx * u + transform.yy * v + transform.y0,
+                        sample);
+
+      for (c = 0; c < 3; c++)
+        max_diff = MAX (max_diff,
+                        fabs (PIXEL_TO_DOUBLE (out[j * 3 + c]) - sample[c]));
+    }
+
+  printf ("%-8s %-16s max difference to sample_buffer_u8 %g\n",
+          PIXEL_FORMAT_NAME, path, max_diff);
+
+  t0 = monotonic_now ();
+  for (i = 0; i < n_iter; i++)
+    {
+      for (j = 0; j < 512; j++)
+        {
+          double u = map->points[j * 2 + 0], v = map->points[j * 2 + 1];
+
+          sample_buffer_u8 (image->pixels, image->width, image->height,
+                            image->rowstride,
+                            transform.xx * u + transform.xy * v + transform.x0,
+                            transform.yx * u + transform.yy * v + transform.y0,
+                            sample);
+          out[j * 3 + 0] = PIXEL_FROM_DOUBLE (sample[0]);
+          out[j * 3 + 1] = PIXEL_FROM_DOUBLE (sample[1]);
+          out[j * 3 + 2] = PIXEL_FROM_DOUBLE (sample[2]);
+        }
+    }
+  t1 = monotonic_now ();
+
+  printf ("%-8s %-16s %-18s %11.1f ns/call\n",
+          PIXEL_FORMAT_NAME, path, "sample_buffer_u8",
+          (t1 - t0) * 1000000000.0 / n_iter);
+
+  t0 = monotonic_now ();
+  for (i = 0; i < n_iter; i++)
+    {
+      sample_map_update (map, &transform, image->width, image->height,
+                         image->rowstride);
+      sample_map_apply_u8 (map, image->pixels, out);
+    }
+  t1 = monotonic_now ();
+
+  printf ("%-8s %-16s %-18s %11.1f ns/call\n",
+          PIXEL_FORMAT_NAME, path, "sample_map_apply",
+          (t1 - t0) * 1000000000.0 / n_iter);
+
+  /* a transform that changes every frame, the worst case for the map */
+  t0 = monotonic_now ();
+  for (i = 0; i < n_iter; i++)
+    {
+      transform.x0 = 12.0 + (i % 100) * 0.01;
+      sample_map_update (map, &transform, image->width, image->height,
+                         image->rowstride);
+      sample_map_apply_u8 (map, image->pixels, out);
+    }
+  t1 = monotonic_now ();
+
+  printf ("%-8s %-16s %-18s %11.1f ns/call\n",
+          PIXEL_FORMAT_NAME, path, "sample_map rebuild",
+          (t1 - t0) * 1000000000.0 / n_iter);
+
+  sample_map_free (map);
+  free (out);
+  image_unref (image);
+}
+
+
+#define POOL_BLOBS 16
+
+static void
+pool_blob_params (int     i,
+                  double  t,
+                  double *c,
+                  double *r)
+{
+  c[0] = fmod (t + i * 0.37, 2.0);
+  c[1] = fmod (i * 0.61, 2.0);
+  c[2] = fmod (t * 0.5 + i * 0.29, 2.0);
+  *r = 0.3 + (i % 4) * 0.1;
+}
+
+
+static void
+pool_blobs (pixel_t            *fb,
+            const CubeGeometry *geom,
+            double              t,
+            int                 x_start,
+            int                 x_end)
+{
+  int i;
+
+  framebuffer_set_slab (fb, geom, x_start, x_end, 0.1, 0.0, 0.2);
+
+  for (i = 0; i < POOL_BLOBS; i++)
+    {
+      double c[3], r;
+
+      pool_blob_params (i, t, c, &r);
+      render_blob_slab (fb, geom, x_start, x_end, c[0], c[1], c[2],
+                        1.0, 0.5, 0.0, r, 1.5);
+    }
+}
+
+
+static void
+pool_ball (pixel_t            *fb,
+           const CubeGeometry *geom,
+           double              t,
+           int                 x_start,
+           int                 x_end)
+{
+  render_ball_slab (t, fb, geom, x_start, x_end);
+}
+
+
+/* a crossfade of two modes that get split into slabs.  Returns the
+ * number of thread counts that rendered something else than the whole
+ * cube functions. */
+static int
+bench_pool (const char         *geom_name,
+            const CubeGeometry *geom,
+            int                 n_iter)
+{
+  const size_t size = geom->fb_size * sizeof (pixel_t);
+  const double t = 0.7;
+  pixel_t *ref_ball, *ref_blobs, *ball, *blobs;
+  int n_max, n_threads, i, n_failed = 0;
+
+  n_max = MAX (sysconf (_SC_NPROCESSORS_ONLN), 4);
+
+  ref_ball = framebuffer_new (geom);
+  ref_blobs = framebuffer_new (geom);
+  ball = framebuffer_new (geom);
+  blobs = framebuffer_new (geom);
+
+  render_ball (t, ref_ball, geom);
+  framebuffer_set (ref_blobs, geom, 0.1, 0.0, 0.2);
+  for (i = 0; i < POOL_BLOBS; i++)
+    {
+      double c[3], r;
+
+      pool_blob_params (i, t, c, &r);
+      render_blob (ref_blobs, geom, c[0], c[1], c[2], 1.0, 0.5, 0.0, r, 1.5);
+    }
+
+  for (n_threads = 1; n_threads <= n_max; n_threads++)
+    {
+      RenderJob jobs[2] = { { pool_ball, ball, 1 }, { pool_blobs, blobs, 1 } };
+      RenderPool *pool;
+      char name[32];
+      double t0, t1;
+
+      pool = render_pool_new (n_threads);
+
+      t0 = monotonic_now ();
+      for (i = 0; i < n_iter; i++)
+        render_pool_render (pool, geom, t, jobs, 2);
+      t1 = monotonic_now ();
+
+      snprintf (name, sizeof (name), "pool %d threads", pool->n_threads);
+      report (geom_name, geom, name, t0, t1, n_iter);
+
+      if (memcmp (ball, ref_ball, size) != 0 ||
+          memcmp (blobs, ref_blobs, size) != 0)
+        {
+          fprintf (stderr, "%s: %d threads rendered a different frame\n",
+                   geom_name, n_threads);
+          n_failed++;
+        }
+
+      render_pool_free (pool);
+    }
+
+  framebuffer_free (ref_ball);
+  framebuffer_free (ref_blobs);
+  framebuffer_free (ball);
+  framebuffer_free (blobs);
+
+  return n_failed;
+}
+
+
+/* what recording a duration costs on the render path, and whether
+ * the percentiles of 1 .. 1000 us come out right.  Returns the number
+ * of percentiles that are off by more than the bucket precision. */
+static int
+bench_histogram (int n_iter)
+{
+  static const double p[] = { 0.01, 0.5, 0.9, 0.99, 1.0 };
+  Histogram *hist;
+  double t0, t1;
+  int i, n_failed = 0;
+
+  hist = calloc (1, sizeof (Histogram));
+
+  t0 = monotonic_now ();
+  for (i = 0; i < n_iter; i++)
+    histogram_record (hist, (i % 1000 + 1) / 1000000.0);
+  t1 = monotonic_now ();
+
+  printf ("%-8s %-16s %-18s %11.1f ns/call\n",
+          "", "", "histogram_record", (t1 - t0) * 1000000000.0 / n_iter);
+
+  for (i = 0; i < (int) (sizeof (p) / sizeof (p[0])); i++)
+    {
+      double expected = p[i] * 1000.0 / 1000000.0;
+      double value = histogram_percentile (hist, p[i]);
+
+      if (fabs (value - expected) > expected / 16.0 + 1.0e-9)
+        {
+          fprintf (stderr, "histogram: p%g is %g us instead of %g us\n",
+                   p[i] * 100.0, value * 1000000.0, expected * 1000000.0);
+          n_failed++;
+        }
+    }
+
+  if (fabs (histogram_mean (hist) - 500.5e-6) > 1.0e-9 ||
+      histogram_max (hist) != 1000.0e-6)
+    {
+      fprintf (stderr, "histogram: mean %g us, max %g us\n",
+               histogram_mean (hist) * 1000000.0,
+               histogram_max (hist) * 1000000.0);
+      n_failed++;
+    }
+
+  free (hist);
+
+  return n_failed;
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+  int n_iter = argc > 1 ? atoi (argv[1]) : 100000;
+  CubeGeometry geom;
+  int size, n_failed = 0;
+
+  for (size = 8; size <= 32; size *= 2)
+    {
+      char name[32];
+
+      cube_geometry_init (&geom, size, size, size, CUBE_ORDER_XYZ);
+      snprintf (name, sizeof (name), "%dx%dx%d", size, size, size);
+      n_failed += check_blob (name, &geom, 200);
+      n_failed += bench_geometry (name, &geom, n_iter);
+
+      geom.fast_size = 0;
+      snprintf (name, sizeof (name), "%dx%dx%d generic", size, size, size);
+      n_failed += check_blob (name, &geom, 200);
+      n_failed += bench_geometry (name, &geom, n_iter);
+
+      n_iter /= 8;
+    }
+
+  for (size = 8; size <= 32; size *= 2)
+    {
+      char name[32];
+
+      cube_geometry_init (&geom, size, size, size, CUBE_ORDER_XYZ);
+      snprintf (name, sizeof (name), "%dx%dx%d", size, size, size);
+      n_failed += bench_pool (name, &geom, 50000 / (size * size));
+    }
+
+  cube_geometry_parse (&geom, "12x8x5:zyx");
+  n_failed += check_blob ("12x8x5:zyx", &geom, 200);
+  n_failed += bench_pool ("12x8x5:zyx", &geom, 100);
+
+  bench_image ("swirl.png", 1000);
+  bench_sample_map ("swirl.png", 10000);
+  n_failed += bench_histogram (1000000);
+
+  return n_failed ? 1 : 0;
+}
@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "frame-scheduler.h"
+#include "render-pool.h"
+
+
+static void
+render_pool_run_tasks (RenderPool      *pool,
+                       const RenderJob *jobs)
+{
+  int i;
+
+  while ((i = atomic_fetch_add (&pool->next_task, 1)) < pool->n_tasks)
+    {
+      RenderTask *task = pool->tasks + i;
+      const int timed = jobs[task->job].hist != NULL;
+      double t0 = timed ? monotonic_now () : 0.0;
+
+      task->func (task->fb, pool->geom, pool->t, task->x_start, task->x_end);
+
+      if (timed)
+        task->time = monotonic_now () - t0;
+    }
+}
+
+
+static void *
+render_pool_thread (void *data)
+{
+  RenderPool *pool = data;
+  unsigned long seen = 0;
+
+  pthread_mutex_lock (&pool->lock);
+
+  while (1)
+    {
+      while (!pool->quit && pool->generation == seen)
+        pthread_cond_wait (&pool->start, &pool->lock);
+
+      if (pool->quit)
+        break;
+
+      seen = pool->generation;
+      pthread_mutex_unlock (&pool->lock);
+
+      render_pool_run_tasks (pool, pool->jobs);
+
+      pthread_mutex_lock (&pool->lock);
+      if (--pool->n_busy == 0)
+        pthread_cond_signal (&pool->done);
+    }
+
+  pthread_mutex_unlock (&pool->lock);
+
+  return NULL;
+}
+
+
+/* the tasks are in job order, the slabs of a job next to each other */
+static void
+render_pool_record (RenderPool      *pool,
+                    const RenderJob *jobs)
+{
+  double time = 0.0;
+  int i;
+
+  for (i = 0; i < pool->n_tasks; i++)
+    {
+      const RenderTask *task = pool->tasks + i;
+
+      time += task->time;
+
+      if (i + 1 == pool->n_tasks || task[1].job != task->job)
+        {
+          if (jobs[task->job].hist)
+            histogram_record (jobs[task->job].hist, time);
+          time = 0.0;
+        }
+    }
+}
+
+
+/* n_threads includes the calling thread, 0 means one per CPU */
+RenderPool *
+render_pool_new (int n_threads)
+{
+  RenderPool *pool;
+  int i;
+
+  if (n_threads <= 0)
+    n_threads = MAX (sysconf (_SC_NPROCESSORS_ONLN), 1);
+
+  pool = calloc (1, sizeof (RenderPool));
+  pool->threads = calloc (n_threads, sizeof (pthread_t));
+  pthread_mutex_init (&pool->lock, NULL);
+  pthread_cond_init (&pool->start, NULL);
+  pthread_cond_init (&pool->done, NULL);
+  pool->n_threads = 1;
+
+  for (i = 1; i < n_threads; i++)
+    {
+      if (pthread_create (&pool->threads[i], NULL,
+                          render_pool_thread, pool) != 0)
+        {
+          fprintf (stderr, "can't start render thread %d, using %d\n",
+                   i, pool->n_threads);
+          break;
+        }
+
+      pool->n_threads++;
+    }
+
+  return pool;
+}
+
+
+void
+render_pool_render (RenderPool         *pool,
+                    const CubeGeometry *geom,
+                    double              t,
+                    const RenderJob    *jobs,
+                    int                 n_jobs)
+{
+  int i, k;
+
+  pool->geom = geom;
+  pool->t = t;
+  pool->jobs = jobs;
+  pool->n_tasks = 0;
+
+  for (i = 0; i < n_jobs; i++)
+    {
+      int n_slabs = 1;
+
+      if (jobs[i].split && pool->n_threads > 1)
+        n_slabs = MIN (pool->n_threads, geom->size_x);
+
+      if (pool->n_tasks + n_slabs > pool->max_tasks)
+        {
+          pool->max_tasks = pool->n_tasks + n_slabs;
+          pool->tasks = realloc (pool->tasks,
+                                 pool->max_tasks * sizeof (RenderTask));
+        }
+
+      for (k = 0; k < n_slabs; k++)
+        {
+          RenderTask *task = pool->tasks + pool->n_tasks++;
+
+          task->func = jobs[i].func;
+          task->fb = jobs[i].fb;
+          task->x_start = geom->size_x * k / n_slabs;
+          task->x_end = geom->size_x * (k + 1) / n_slabs;
+          task->job = i;
+          task->time = 0.0;
+        }
+    }
+
+  atomic_store (&pool->next_task, 0);
+
+  /* nothing to share, don't wake anyone */
+  if (pool->n_threads == 1 || pool->n_tasks <= 1)
+    {
+      render_pool_run_tasks (pool, jobs);
+      render_pool_record (pool, jobs);
+      return;
+    }
+
+  pthread_mutex_lock (&pool->lock);
+  pool->n_busy = pool->n_threads - 1;
+  pool->generation++;
+  pthread_cond_broadcast (&pool->start);
+  pthread_mutex_unlock (&pool->lock);
+
+  render_pool_run_tasks (pool, jobs);
+
+  /* the workers may still be busy with the last slabs */
+  pthread_mutex_lock (&pool->lock);
+  while (pool->n_busy > 0)
+    pthread_cond_wait (&pool->done, &pool->lock);
+  pthread_mutex_unlock (&pool->lock);
+
+  render_pool_record (pool, jobs);
+}
+
+
+void
+render_pool_free (RenderPool *pool)
+{
+  int i;
+
+  pthread_mutex_lock (&pool->lock);
+  pool->quit = 1;
+  pthread_cond_broadcast (&pool->start);
+  pthread_mutex_unlock (&pool->lock);
+
+  for (i = 1; i < pool->n_threads; i++)
+    pthread_join (pool->threads[i], NULL);
+
+  pthread_mutex_destroy (&pool->lock);
+  pthread_cond_destroy (&pool->start);
+  pthread_cond_destroy (&pool->done);
+  free (pool->threads);
+  free (pool->tasks);
+  free (pool);
+}
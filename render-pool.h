@@ -0,0 +1,91 @@
+#ifndef __RENDER_POOL_H__
+#define __RENDER_POOL_H__
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "render-utils.h"
+#include "histogram.h"
+
+/*
+ * Worker threads for rendering a frame.  A frame is a list of jobs, a
+ * render function and the framebuffer it paints, e.g. one per layer.
+ * Jobs that allow it get split into slabs of whole x planes, one per
+ * thread.  The slabs of all jobs get handed out to the threads, the
+ * calling one included, until none are left, and render_pool_render ()
+ * returns when the frame is done.  A pool of one thread renders every
+ * job in one piece, in order, without any locking.
+ *
+ * A render function that gets split may only touch the x planes of its
+ * slab and must not keep state between calls.  A function that doesn't
+ * get split is called with the whole range and runs on a single
+ * thread, concurrent with the other jobs, so it must not share state
+ * with them either: no drand48 (), random () and the like, erand48 ()
+ * with a state of its own is fine.  With x as the slowest axis
+ * a slab is one run of the buffer, so threads don't share cache lines
+ * either, other orders still render correctly.
+ *
+ * A job with a histogram gets the time spent on it recorded there, the
+ * sum over its slabs: what the job costs, not how long the frame
+ * waited for it.
+ */
+
+typedef void (*RenderFunc) (pixel_t            *fb,
+                            const CubeGeometry *geom,
+                            double              t,
+                            int                 x_start,
+                            int                 x_end);
+
+typedef struct
+{
+  RenderFunc          func;
+  pixel_t            *fb;
+  int                 split;         /* may be rendered in slabs */
+  Histogram          *hist;          /* or NULL */
+} RenderJob;
+
+typedef struct
+{
+  RenderFunc          func;
+  pixel_t            *fb;
+  int                 x_start;
+  int                 x_end;
+  int                 job;
+  double              time;          /* seconds, only for timed jobs */
+} RenderTask;
+
+struct _render_pool
+{
+  int                 n_threads;     /* including the calling one */
+
+  /* private */
+  pthread_t          *threads;
+  pthread_mutex_t     lock;
+  pthread_cond_t      start;
+  pthread_cond_t      done;
+  unsigned long       generation;    /* counts the frames handed out */
+  int                 n_busy;        /* workers not done with the frame */
+  int                 quit;
+
+  /* the frame being rendered */
+  const CubeGeometry *geom;
+  double              t;
+  const RenderJob    *jobs;
+  RenderTask         *tasks;
+  int                 n_tasks;
+  int                 max_tasks;
+  atomic_int          next_task;
+};
+
+typedef struct _render_pool RenderPool;
+
+
+RenderPool * render_pool_new    (int                 n_threads);
+void         render_pool_render (RenderPool         *pool,
+                                 const CubeGeometry *geom,
+                                 double              t,
+                                 const RenderJob    *jobs,
+                                 int                 n_jobs);
+void         render_pool_free   (RenderPool         *pool);
+
+#endif
@@ -0,0 +1,276 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "frame-scheduler.h"
+#include "render-stats.h"
+
+/* set by the signal handler, picked up by render_stats_poll () */
+static volatile sig_atomic_t dump_requested = 0;
+
+
+RenderStats *
+render_stats_new (void)
+{
+  RenderStats *stats;
+
+  stats = calloc (1, sizeof (RenderStats));
+  stats->start = monotonic_now ();
+  stats->last_report = stats->start;
+  stats->listen_fd = -1;
+
+  return stats;
+}
+
+
+/* registers a stage.  Its durations go into hist, or into a new
+ * histogram when hist is NULL, which gets returned either way. */
+Histogram *
+render_stats_add_stage (RenderStats *stats,
+                        const char  *name,
+                        Histogram   *hist)
+{
+  RenderStage *stage;
+
+  stats->stages = realloc (stats->stages,
+                           (stats->n_stages + 1) * sizeof (RenderStage));
+  stage = &stats->stages[stats->n_stages++];
+
+  stage->name = strdup (name);
+  stage->owned = hist == NULL;
+  stage->hist = hist ? hist : calloc (1, sizeof (Histogram));
+
+  return stage->hist;
+}
+
+
+/* returns the index for render_stats_set_counter () */
+int
+render_stats_add_counter (RenderStats *stats,
+                          const char  *name)
+{
+  stats->counters = realloc (stats->counters,
+                             (stats->n_counters + 1) * sizeof (RenderCounter));
+  stats->counters[stats->n_counters].name = strdup (name);
+  stats->counters[stats->n_counters].value = 0;
+
+  return stats->n_counters++;
+}
+
+
+void
+render_stats_set_counter (RenderStats  *stats,
+                          int           counter,
+                          unsigned long value)
+{
+  if (counter < 0 || counter >= stats->n_counters)
+    return;
+
+  stats->counters[counter].value = value;
+}
+
+
+void
+render_stats_frame_done (RenderStats *stats)
+{
+  stats->frames++;
+}
+
+
+/* serves the report on a Unix socket at path, replacing a stale one */
+int
+render_stats_listen (RenderStats *stats,
+                     const char  *path)
+{
+  struct sockaddr_un addr = { AF_UNIX, };
+  int fd;
+
+  if (strlen (path) >= sizeof (addr.sun_path))
+    {
+      fprintf (stderr, "stats socket path too long: %s\n", path);
+      return 0;
+    }
+
+  strcpy (addr.sun_path, path);
+
+  fd = socket (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    {
+      perror ("socket");
+      return 0;
+    }
+
+  unlink (path);
+
+  if (bind (fd, (struct sockaddr *) &addr, sizeof (addr)) < 0 ||
+      listen (fd, 4) < 0)
+    {
+      perror (path);
+      close (fd);
+      return 0;
+    }
+
+  stats->listen_fd = fd;
+  stats->socket_path = strdup (path);
+
+  return 1;
+}
+
+
+static void
+render_stats_signal (int signum)
+{
+  dump_requested = 1;
+}
+
+
+/* a report to stderr whenever signum (e.g. SIGUSR1) arrives */
+int
+render_stats_dump_on (int signum)
+{
+  struct sigaction action;
+
+  memset (&action, 0, sizeof (action));
+  action.sa_handler = render_stats_signal;
+  action.sa_flags = SA_RESTART;
+  sigemptyset (&action.sa_mask);
+
+  if (sigaction (signum, &action, NULL) < 0)
+    {
+      perror ("sigaction");
+      return 0;
+    }
+
+  return 1;
+}
+
+
+void
+render_stats_report (RenderStats *stats,
+                     FILE        *out)
+{
+  double now = monotonic_now ();
+  double uptime = now - stats->start;
+  double interval = now - stats->last_report;
+  int i;
+
+  fprintf (out, "uptime %.1f s, %lu frames, %.2f fps, %.2f fps since "
+           "the last report\n",
+           uptime, stats->frames,
+           uptime > 0.0 ? stats->frames / uptime : 0.0,
+           interval > 0.0 ?
+             (stats->frames - stats->frames_reported) / interval : 0.0);
+
+  fprintf (out, "%-24s %10s %10s %10s %10s %10s\n",
+           "stage", "count", "mean ms", "p50 ms", "p99 ms", "max ms");
+
+  for (i = 0; i < stats->n_stages; i++)
+    {
+      const Histogram *hist = stats->stages[i].hist;
+
+      fprintf (out, "%-24s %10lu %10.3f %10.3f %10.3f %10.3f\n",
+               stats->stages[i].name,
+               atomic_load_explicit (&hist->count, memory_order_relaxed),
+               histogram_mean (hist) * 1000.0,
+               histogram_percentile (hist, 0.50) * 1000.0,
+               histogram_percentile (hist, 0.99) * 1000.0,
+               histogram_max (hist) * 1000.0);
+    }
+
+  for (i = 0; i < stats->n_counters; i++)
+    fprintf (out, "%-24s %10lu\n",
+             stats->counters[i].name, stats->counters[i].value);
+
+  stats->last_report = now;
+  stats->frames_reported = stats->frames;
+}
+
+
+/* hands the whole report to a reader, without ever waiting for one
+ * that doesn't read: whatever doesn't fit its socket buffer is lost */
+static void
+render_stats_serve (RenderStats *stats,
+                    int          fd)
+{
+  char *text = NULL;
+  size_t size = 0;
+  FILE *out;
+
+  out = open_memstream (&text, &size);
+  if (!out)
+    {
+      perror ("open_memstream");
+      return;
+    }
+
+  render_stats_report (stats, out);
+  fclose (out);
+
+  if (send (fd, text, size, MSG_DONTWAIT | MSG_NOSIGNAL) < 0 &&
+      errno != EAGAIN && errno != EPIPE && errno != ECONNRESET)
+    perror ("send");
+
+  free (text);
+}
+
+
+/* call once per frame, answers pending signals and connections */
+void
+render_stats_poll (RenderStats *stats)
+{
+  if (dump_requested)
+    {
+      dump_requested = 0;
+      render_stats_report (stats, stderr);
+    }
+
+  while (stats->listen_fd >= 0)
+    {
+      int fd = accept4 (stats->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+
+      if (fd < 0)
+        {
+          if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            perror ("accept");
+          break;
+        }
+
+      render_stats_serve (stats, fd);
+      close (fd);
+    }
+}
+
+
+void
+render_stats_free (RenderStats *stats)
+{
+  int i;
+
+  if (stats->listen_fd >= 0)
+    {
+      close (stats->listen_fd);
+      unlink (stats->socket_path);
+    }
+
+  for (i = 0; i < stats->n_stages; i++)
+    {
+      free (stats->stages[i].name);
+      if (stats->stages[i].owned)
+        free (stats->stages[i].hist);
+    }
+
+  for (i = 0; i < stats->n_counters; i++)
+    free (stats->counters[i].name);
+
+  free (stats->stages);
+  free (stats->counters);
+  free (stats->socket_path);
+  free (stats);
+}
@@ -0,0 +1,71 @@
+#ifndef __RENDER_STATS_H__
+#define __RENDER_STATS_H__
+
+#include <stdio.h>
+
+#include "histogram.h"
+
+/*
+ * Live statistics of a render loop: a histogram per stage of a frame
+ * (a mode, compositing, quantizing, sending, ...) and a set of
+ * counters.  The report shows count, mean, p50, p99 and max of every
+ * stage, the frame rate and the counters.  It goes to stderr on a
+ * signal, and to whoever connects to a Unix socket, e.g.
+ *
+ *   socat - UNIX-CONNECT:/tmp/renderer.stats
+ *
+ * Both get served from render_stats_poll () in the render loop, so no
+ * reader can make the loop wait and nothing needs a lock.
+ */
+
+typedef struct
+{
+  char               *name;
+  Histogram          *hist;
+  int                 owned;         /* allocated by render_stats_add_stage () */
+} RenderStage;
+
+typedef struct
+{
+  char               *name;
+  unsigned long       value;
+} RenderCounter;
+
+struct _render_stats
+{
+  RenderStage        *stages;
+  int                 n_stages;
+  RenderCounter      *counters;
+  int                 n_counters;
+  unsigned long       frames;
+
+  /* private */
+  double              start;
+  double              last_report;
+  unsigned long       frames_reported;
+  int                 listen_fd;
+  char               *socket_path;
+};
+
+typedef struct _render_stats RenderStats;
+
+
+RenderStats * render_stats_new         (void);
+Histogram *   render_stats_add_stage   (RenderStats *stats,
+                                        const char  *name,
+                                        Histogram   *hist);
+int           render_stats_add_counter (RenderStats *stats,
+                                        const char  *name);
+void          render_stats_set_counter (RenderStats  *stats,
+                                        int           counter,
+                                        unsigned long value);
+void          render_stats_frame_done  (RenderStats *stats);
+int           render_stats_listen      (RenderStats *stats,
+                                        const char  *path);
+int           render_stats_dump_on     (int          signum);
+void          render_stats_poll        (RenderStats *stats);
+void          render_stats_report      (RenderStats *stats,
+                                        FILE        *out);
+void          render_stats_free        (RenderStats *stats);
+
+#endif
@@ -1,6 +1,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <math.h>
 
@@ -8,8 +9,153 @@
 
 #include "render-utils.h"
 
+const CubeGeometry cube_geometry_8 =
+{
+  8, 8, 8,
+  64, 8, 1,
+  CUBE_ORDER_XYZ,
+  8 * 8 * 8,
+  8 * 8 * 8 * 3,
+  8,
+};
+
+
+int
+cube_geometry_init (CubeGeometry *geom,
+                    int           size_x,
+                    int           size_y,
+                    int           size_z,
+                    CubeOrder     order)
+{
+  int sizes[3] = { size_x, size_y, size_z };
+  int strides[3];
+  /* axes from the fastest to the slowest varying one */
+  static const int axes[][3] =
+    {
+      [CUBE_ORDER_XYZ] = { 2, 1, 0 },
+      [CUBE_ORDER_XZY] = { 1, 2, 0 },
+      [CUBE_ORDER_YXZ] = { 2, 0, 1 },
+      [CUBE_ORDER_YZX] = { 0, 2, 1 },
+      [CUBE_ORDER_ZXY] = { 1, 0, 2 },
+      [CUBE_ORDER_ZYX] = { 0, 1, 2 },
+    };
+  int i, stride;
+
+  if (size_x < 1 || size_y < 1 || size_z < 1 ||
+      order < CUBE_ORDER_XYZ || order > CUBE_ORDER_ZYX)
+    {
+      fprintf (stderr, "invalid cube geometry %dx%dx%d\n",
+               size_x, size_y, size_z);
+      return 0;
+    }
+
+  if ((long) size_x * size_y * size_z * 3 > 0x7fffffff / (long) sizeof (pixel_t))
+    {
+      fprintf (stderr, "cube geometry %dx%dx%d too big\n",
+               size_x, size_y, size_z);
+      return 0;
+    }
+
+  stride = 1;
+  for (i = 0; i < 3; i++)
+    {
+      strides[axes[order][i]] = stride;
+      stride *= sizes[axes[order][i]];
+    }
+
+  geom->size_x = size_x;
+  geom->size_y = size_y;
+  geom->size_z = size_z;
+  geom->stride_x = strides[0];
+  geom->stride_y = strides[1];
+  geom->stride_z = strides[2];
+  geom->order = order;
+  geom->n_pixels = size_x * size_y * size_z;
+  geom->fb_size = geom->n_pixels * 3;
+
+  if (order == CUBE_ORDER_XYZ &&
+      size_x == size_y && size_y == size_z &&
+      (size_x == 8 || size_x == 16 || size_x == 32))
+    geom->fast_size = size_x;
+  else
+    geom->fast_size = 0;
+
+  return 1;
+}
+
+
+/* "16" or "16x16x8", optionally followed by ":zyx" for the pixel order */
+int
+cube_geometry_parse (CubeGeometry *geom,
+                     const char   *spec)
+{
+  static const char *orders[] =
+    {
+      [CUBE_ORDER_XYZ] = "xyz",
+      [CUBE_ORDER_XZY] = "xzy",
+      [CUBE_ORDER_YXZ] = "yxz",
+      [CUBE_ORDER_YZX] = "yzx",
+      [CUBE_ORDER_ZXY] = "zxy",
+      [CUBE_ORDER_ZYX] = "zyx",
+    };
+  int size_x, size_y, size_z;
+  CubeOrder order = CUBE_ORDER_XYZ;
+  const char *colon;
+  int n;
+
+  if (sscanf (spec, "%dx%dx%d%n", &size_x, &size_y, &size_z, &n) == 3)
+    ;
+  else if (sscanf (spec, "%d%n", &size_x, &n) == 1)
+    size_y = size_z = size_x;
+  else
+    n = -1;
+
+  colon = n >= 0 ? spec + n : NULL;
+  if (colon && *colon == ':')
+    {
+      for (order = CUBE_ORDER_XYZ; order <= CUBE_ORDER_ZYX; order++)
+        {
+          if (strcmp (colon + 1, orders[order]) == 0)
+            break;
+        }
+    }
+  else if (colon && *colon != '\0')
+    {
+      colon = NULL;
+    }
+
+  if (!colon || order > CUBE_ORDER_ZYX)
+    {
+      fprintf (stderr, "can't parse cube geometry \"%s\"\n", spec);
+      return 0;
+    }
+
+  return cube_geometry_init (geom, size_x, size_y, size_z, order);
+}
+
+
+/* number of slabs along the slowest varying axis, every slab is a
+ * contiguous fb_size / n channels in the framebuffer */
+int
+cube_geometry_slabs (const CubeGeometry *geom)
+{
+  switch (geom->order)
+    {
+      case CUBE_ORDER_XYZ:
+      case CUBE_ORDER_XZY:
+        return geom->size_x;
+      case CUBE_ORDER_YXZ:
+      case CUBE_ORDER_YZX:
+        return geom->size_y;
+      default:
+        return geom->size_z;
+    }
+}
+
+
 void
-pixel_set (double *framebuffer,
+pixel_set (pixel_t            *framebuffer,
+           const CubeGeometry *geom,
            int x,
            int y,
            int z,
@@ -17,20 +163,41 @@ pixel_set (double *framebuffer,
            double green,
            double blue)
 {
+  pixel_t *pixel;
+
   if (x < 0 || y < 0 || z < 0)
     return;
 
-  if (x >= 8 || y >= 8 || z >= 8)
+  if (x >= geom->size_x || y >= geom->size_y || z >= geom->size_z)
     return;
 
-  framebuffer[(((x * 8) + y) * 8 + z) * 3 + 0] = red;
-  framebuffer[(((x * 8) + y) * 8 + z) * 3 + 1] = green;
-  framebuffer[(((x * 8) + y) * 8 + z) * 3 + 2] = blue;
+  pixel = framebuffer + CUBE_INDEX (geom, x, y, z) * 3;
+
+  pixel[0] = PIXEL_FROM_DOUBLE (red);
+  pixel[1] = PIXEL_FROM_DOUBLE (green);
+  pixel[2] = PIXEL_FROM_DOUBLE (blue);
+}
+
+
+static inline void
+blend_pixel (pixel_t *pixel,
+             double   red,
+             double   green,
+             double   blue,
+             double   alpha)
+{
+  pixel[0] = PIXEL_FROM_DOUBLE (PIXEL_TO_DOUBLE (pixel[0]) * (1.0 - alpha) +
+                                red   * alpha);
+  pixel[1] = PIXEL_FROM_DOUBLE (PIXEL_TO_DOUBLE (pixel[1]) * (1.0 - alpha) +
+                                green * alpha);
+  pixel[2] = PIXEL_FROM_DOUBLE (PIXEL_TO_DOUBLE (pixel[2]) * (1.0 - alpha) +
+                                blue  * alpha);
 }
 
 
 void
-render_pixel (double *framebuffer,
+render_pixel (pixel_t            *framebuffer,
+              const CubeGeometry *geom,
               int x,
               int y,
               int z,
@@ -42,22 +209,17 @@ render_pixel (double *framebuffer,
   if (x < 0 || y < 0 || z < 0)
     return;
 
-  if (x >= 8 || y >= 8 || z >= 8)
+  if (x >= geom->size_x || y >= geom->size_y || z >= geom->size_z)
     return;
 
-  framebuffer[(((x * 8) + y) * 8 + z) * 3 + 0] *= 1.0   - alpha;
-  framebuffer[(((x * 8) + y) * 8 + z) * 3 + 0] += red   * alpha;
-
-  framebuffer[(((x * 8) + y) * 8 + z) * 3 + 1] *= 1.0   - alpha;
-  framebuffer[(((x * 8) + y) * 8 + z) * 3 + 1] += green * alpha;
-
-  framebuffer[(((x * 8) + y) * 8 + z) * 3 + 2] *= 1.0   - alpha;
-  framebuffer[(((x * 8) + y) * 8 + z) * 3 + 2] += blue  * alpha;
+  blend_pixel (framebuffer + CUBE_INDEX (geom, x, y, z) * 3,
+               red, green, blue, alpha);
 }
 
 
 void
-interpolate_pixel (double *fb,
+interpolate_pixel (pixel_t            *fb,
+                   const CubeGeometry *geom,
                    double x,
                    double y,
                    double z,
@@ -66,7 +228,7 @@ interpolate_pixel (double *fb,
                    double blue,
                    double alpha)
 {
-  render_pixel (fb,
+  render_pixel (fb, geom,
                 (int) x,
                 (int) y,
                 (int) z,
@@ -76,7 +238,7 @@ interpolate_pixel (double *fb,
                 (1.0 - (y - (int) y)) *
                 (1.0 - (z - (int) z)));
 
-  render_pixel (fb,
+  render_pixel (fb, geom,
                 1 + (int) x,
                 (int) y,
                 (int) z,
@@ -86,7 +248,7 @@ interpolate_pixel (double *fb,
                 (1.0 - (y - (int) y)) *
                 (1.0 - (z - (int) z)));
 
-  render_pixel (fb,
+  render_pixel (fb, geom,
                 (int) x,
                 1 + (int) y,
                 (int) z,
@@ -96,7 +258,7 @@ interpolate_pixel (double *fb,
                 ((y - (int) y)) *
                 (1.0 - (z - (int) z)));
 
-  render_pixel (fb,
+  render_pixel (fb, geom,
                 (int) x,
                 (int) y,
                 1 + (int) z,
@@ -106,7 +268,7 @@ interpolate_pixel (double *fb,
                 (1.0 - (y - (int) y)) *
                 ((z - (int) z)));
 
-  render_pixel (fb,
+  render_pixel (fb, geom,
                 (int) x,
                 1 + (int) y,
                 1 + (int) z,
@@ -116,7 +278,7 @@ interpolate_pixel (double *fb,
                 ((y - (int) y)) *
                 ((z - (int) z)));
 
-  render_pixel (fb,
+  render_pixel (fb, geom,
                 1 + (int) x,
                 (int) y,
                 1 + (int) z,
@@ -126,7 +288,7 @@ interpolate_pixel (double *fb,
                 (1.0 - (y - (int) y)) *
                 ((z - (int) z)));
 
-  render_pixel (fb,
+  render_pixel (fb, geom,
                 1 + (int) x,
                 1 + (int) y,
                 (int) z,
@@ -136,7 +298,7 @@ interpolate_pixel (double *fb,
                 ((y - (int) y)) *
                 (1.0 - (z - (int) z)));
 
-  render_pixel (fb,
+  render_pixel (fb, geom,
                 1 + (int) x,
                 1 + (int) y,
                 1 + (int) z,
@@ -148,88 +310,459 @@ interpolate_pixel (double *fb,
 }
 
 
+/*
+ * The blob covers the cube with coordinates 0.0 .. 2.0 on every axis,
+ * independent of the resolution.  Its opacity at distance d from the
+ * center is
+ *
+ *   1 - clamp ((d / r - 0.5) * s + 0.5, 0, 1) ^ s
+ *
+ * which drops to 0 at r_out = r * (0.5 + 0.5 / s).  Written in terms of
+ * u = d^2 / r_out^2 the curve only depends on s, so it gets tabulated
+ * once per sharpness and the voxels look it up by squared distance,
+ * without sqrt () or pow ().  4096 steps keep the linear interpolation
+ * well within one 8 bit step, also at the center for s = 1 where the
+ * curve is a square root of u.
+ */
+#define BLOB_FALLOFF_SIZE  4096
+#define BLOB_FALLOFF_CACHE 4
+#define BLOB_LANES         8
+
+typedef struct
+{
+  double s;                                   /* 0.0 for unused slots */
+  float  alpha[BLOB_FALLOFF_SIZE + 1];
+} BlobFalloff;
+
+
+/* per thread, so renderers running in parallel don't share the slots */
+static const float *
+blob_falloff (double s)
+{
+  static __thread BlobFalloff cache[BLOB_FALLOFF_CACHE];
+  static __thread int next = 0;
+  BlobFalloff *falloff;
+  int i;
+
+  for (i = 0; i < BLOB_FALLOFF_CACHE; i++)
+    {
+      if (cache[i].s == s)
+        return cache[i].alpha;
+    }
+
+  falloff = &cache[next];
+  next = (next + 1) % BLOB_FALLOFF_CACHE;
+
+  for (i = 0; i <= BLOB_FALLOFF_SIZE; i++)
+    {
+      double d;
+
+      d = sqrt ((double) i / BLOB_FALLOFF_SIZE) * (0.5 + 0.5 / s);
+      d = (d - 0.5) * s + 0.5;
+      d = CLAMP (d, 0.0, 1.0);
+
+      falloff->alpha[i] = 1.0 - pow (d, s);
+    }
+
+  /* nothing beyond r_out, even where float rounding says otherwise */
+  falloff->alpha[BLOB_FALLOFF_SIZE] = 0.0f;
+  falloff->s = s;
+
+  return falloff->alpha;
+}
+
+
+/* the voxel indices along one axis within r of c, an empty range
+ * (lo > hi) when there are none */
+static inline __attribute__ ((always_inline)) void
+blob_range (double  c,
+            double  r,
+            double  scale,
+            int     size,
+            int    *lo,
+            int    *hi)
+{
+  double l = ceil ((c - r) / scale);
+  double h = floor ((c + r) / scale);
+
+  /* written so that NaN ends up with the full range */
+  *lo = !(l > 0.0) ? 0 : l > size ? size : (int) l;
+  *hi = !(h < size - 1) ? size - 1 : h < -1.0 ? -1 : (int) h;
+}
+
+
+/*
+ * The body is inlined into a copy per common cube size so the index
+ * math is constant.  Only voxels within r_out get visited: the x range
+ * (clipped to the slab),
+ * the y range of the remaining disc, the z run of the remaining chord.
+ * The squared distances of a run get computed BLOB_LANES at a time, a
+ * constant trip count is what gets gcc to vectorize that at -O2; the
+ * table lookup and the blend follow per voxel.
+ */
+static inline __attribute__ ((always_inline)) void
+render_blob_impl (pixel_t *framebuffer,
+                  int size_x, int size_y, int size_z,
+                  int stride_x, int stride_y, int stride_z,
+                  int x_start, int x_end,
+                  double cx, double cy, double cz,
+                  double red, double green, double blue,
+                  double r, double s)
+{
+  const double scale_x = 2.0 / size_x;
+  const double scale_y = 2.0 / size_y;
+  const double scale_z = 2.0 / size_z;
+  const double r_out = r * (0.5 + 0.5 / s);
+  const double r_out2 = r_out * r_out;
+  const double lut_scale = BLOB_FALLOFF_SIZE / r_out2;
+  const float *falloff = blob_falloff (s);
+  int X, Y, Z, x_lo, x_hi, y_lo, y_hi, z_lo, z_hi;
+
+  blob_range (cx, r_out, scale_x, size_x, &x_lo, &x_hi);
+  x_lo = MAX (x_lo, x_start);
+  x_hi = MIN (x_hi, x_end - 1);
+
+  for (X = x_lo; X <= x_hi; X++)
+    {
+      const double dx = X * scale_x - cx;
+      const double rx2 = r_out2 - dx * dx;
+
+      if (!(rx2 > 0.0))
+        continue;
+
+      blob_range (cy, sqrt (rx2), scale_y, size_y, &y_lo, &y_hi);
+
+      for (Y = y_lo; Y <= y_hi; Y++)
+        {
+          const double dy = Y * scale_y - cy;
+          const double dxy2 = dx * dx + dy * dy;
+          const double rxy2 = r_out2 - dxy2;
+          double u[BLOB_LANES];
+          int n, i;
+
+          if (!(rxy2 > 0.0))
+            continue;
+
+          blob_range (cz, sqrt (rxy2), scale_z, size_z, &z_lo, &z_hi);
+
+          for (Z = z_lo; Z <= z_hi; Z += n)
+            {
+              n = MIN (z_hi - Z + 1, BLOB_LANES);
+
+              /* lanes past the end of the run get computed and ignored */
+              for (i = 0; i < BLOB_LANES; i++)
+                {
+                  const double dz = (Z + i) * scale_z - cz;
+
+                  u[i] = (dxy2 + dz * dz) * lut_scale;
+                }
+
+              for (i = 0; i < n; i++)
+                {
+                  double alpha;
+                  int j;
+
+                  /* the range rounding can leave u just past the end */
+                  if (!(u[i] < BLOB_FALLOFF_SIZE))
+                    continue;
+
+                  j = u[i];
+                  alpha = falloff[j] + (u[i] - j) * (falloff[j + 1] - falloff[j]);
+
+                  blend_pixel (framebuffer +
+                               (X * stride_x + Y * stride_y +
+                                (Z + i) * stride_z) * 3,
+                               red, green, blue, alpha);
+                }
+            }
+        }
+    }
+}
+
+
+/* r and s have to be positive, otherwise nothing gets drawn */
 void
-render_blob (double *framebuffer,
+render_blob (pixel_t            *framebuffer,
+             const CubeGeometry *geom,
              double cx, double cy, double cz,
              double red, double green, double blue,
              double r, double s)
 {
-  int X, Y, Z;
-  double x, y, z;
+  render_blob_slab (framebuffer, geom, 0, geom->size_x,
+                    cx, cy, cz, red, green, blue, r, s);
+}
+
+
+/* the part of the blob in the x planes x_start .. x_end - 1 */
+void
+render_blob_slab (pixel_t            *framebuffer,
+                  const CubeGeometry *geom,
+                  int x_start, int x_end,
+                  double cx, double cy, double cz,
+                  double red, double green, double blue,
+                  double r, double s)
+{
+  if (!(r > 0.0) || !(s > 0.0))
+    return;
 
-  for (X = 0; X < 8; X++)
+#define RENDER_BLOB_CUBE(n) \
+  render_blob_impl (framebuffer, n, n, n, n * n, n, 1, x_start, x_end, \
+                    cx, cy, cz, red, green, blue, r, s)
+
+  switch (geom->fast_size)
     {
-      for (Y = 0; Y < 8; Y++)
-        {
-          for (Z = 0; Z < 8; Z++)
-            {
-              double d;
+      case 8:
+        RENDER_BLOB_CUBE (8);
+        break;
+      case 16:
+        RENDER_BLOB_CUBE (16);
+        break;
+      case 32:
+        RENDER_BLOB_CUBE (32);
+        break;
+      default:
+        render_blob_impl (framebuffer,
+                          geom->size_x, geom->size_y, geom->size_z,
+                          geom->stride_x, geom->stride_y, geom->stride_z,
+                          x_start, x_end,
+                          cx, cy, cz, red, green, blue, r, s);
+        break;
+    }
 
-              x = X * 0.25;
-              y = Y * 0.25;
-              z = Z * 0.25;
+#undef RENDER_BLOB_CUBE
+}
 
-              d = pow ((x - cx) * (x - cx) +
-                       (y - cy) * (y - cy) +
-                       (z - cz) * (z - cz), 0.5);
 
-              d /= r;
-              d = (d - 0.5) * s + 0.5;
-              d = CLAMP (d, 0.0, 1.0);
+/*
+ * Framebuffers come from framebuffer_new (), aligned to
+ * FRAMEBUFFER_ALIGN.  The remaining kernels touch every channel
+ * regardless of the order and walk the buffer in blocks of
+ * FRAMEBUFFER_BLOCK channels: the constant trip count of a block is
+ * what gets gcc to vectorize them at -O2 for any cube size, and a block
+ * is a whole number of cache lines, so on aligned buffers no block
+ * straddles one.  What's left over after the last block goes through
+ * the same code one channel at a time.
+ */
+pixel_t *
+framebuffer_new (const CubeGeometry *geom)
+{
+  size_t size = geom->fb_size * sizeof (pixel_t);
+  void *fb;
 
-              d = pow (d, s);
+  /* posix_memalign () wants at least something */
+  size = (size + FRAMEBUFFER_ALIGN) / FRAMEBUFFER_ALIGN * FRAMEBUFFER_ALIGN;
 
-              render_pixel (framebuffer, X, Y, Z, red, green, blue, 1.0 - d);
-            }
+  if (posix_memalign (&fb, FRAMEBUFFER_ALIGN, size) != 0)
+    {
+      perror ("posix_memalign");
+      return NULL;
+    }
+
+  memset (fb, 0, size);
+
+  return fb;
+}
+
+
+void
+framebuffer_free (pixel_t *fb)
+{
+  free (fb);
+}
+
+
+_Static_assert (FRAMEBUFFER_BLOCK % 3 == 0,
+                "a framebuffer block has to hold whole pixels");
+_Static_assert (FRAMEBUFFER_BLOCK * sizeof (pixel_t) % FRAMEBUFFER_ALIGN == 0,
+                "a framebuffer block has to keep the alignment");
+
+
+static inline __attribute__ ((always_inline)) void
+framebuffer_set_impl (pixel_t *restrict framebuffer,
+                      int               fb_size,
+                      pixel_t           r,
+                      pixel_t           g,
+                      pixel_t           b)
+{
+  int n, i;
+
+  for (n = 0; n + FRAMEBUFFER_BLOCK <= fb_size; n += FRAMEBUFFER_BLOCK)
+    {
+      for (i = 0; i < FRAMEBUFFER_BLOCK; i += 3)
+        {
+          framebuffer[n + i + 0] = r;
+          framebuffer[n + i + 1] = g;
+          framebuffer[n + i + 2] = b;
         }
     }
+
+  for (; n < fb_size; n += 3)
+    {
+      framebuffer[n + 0] = r;
+      framebuffer[n + 1] = g;
+      framebuffer[n + 2] = b;
+    }
+}
+
+
+void
+framebuffer_set (pixel_t            *framebuffer,
+                 const CubeGeometry *geom,
+                 double              red,
+                 double              green,
+                 double              blue)
+{
+  framebuffer_set_impl (framebuffer, geom->fb_size,
+                        PIXEL_FROM_DOUBLE (red),
+                        PIXEL_FROM_DOUBLE (green),
+                        PIXEL_FROM_DOUBLE (blue));
 }
 
 
+/* fills the x planes x_start .. x_end - 1.  With x as the slowest axis
+ * they are one run of the buffer, otherwise they get visited pixel by
+ * pixel. */
 void
-framebuffer_set (double *framebuffer,
-                 double red,
-                 double green,
-                 double blue)
+framebuffer_set_slab (pixel_t            *framebuffer,
+                      const CubeGeometry *geom,
+                      int                 x_start,
+                      int                 x_end,
+                      double              red,
+                      double              green,
+                      double              blue)
 {
+  const pixel_t r = PIXEL_FROM_DOUBLE (red);
+  const pixel_t g = PIXEL_FROM_DOUBLE (green);
+  const pixel_t b = PIXEL_FROM_DOUBLE (blue);
   int x, y, z;
 
-  for (x = 0; x < 8; x++)
+  x_start = MAX (x_start, 0);
+  x_end = MIN (x_end, geom->size_x);
+
+  if (x_start >= x_end)
+    return;
+
+  if (geom->stride_x * geom->size_x == geom->n_pixels)
+    {
+      framebuffer_set_impl (framebuffer + x_start * geom->stride_x * 3,
+                            (x_end - x_start) * geom->stride_x * 3,
+                            r, g, b);
+      return;
+    }
+
+  for (x = x_start; x < x_end; x++)
     {
-      for (y = 0; y < 8; y++)
+      for (y = 0; y < geom->size_y; y++)
         {
-          for (z = 0; z < 8; z++)
+          for (z = 0; z < geom->size_z; z++)
             {
-              pixel_set (framebuffer, x, y, z, red, green, blue);
+              pixel_t *pixel = framebuffer + CUBE_INDEX (geom, x, y, z) * 3;
+
+              pixel[0] = r;
+              pixel[1] = g;
+              pixel[2] = b;
             }
         }
     }
 }
 
 
-void
-framebuffer_dim (double *framebuffer,
-                 double alpha)
+/*
+ * u16 scales in 16.16 fixed point, the product of two 16 bit values
+ * fits 32 bits.  SSE2 has no 32 bit multiply and gcc has to emulate
+ * it.  merge handles 0.0 and 1.0 on its own, so its weights fit 16
+ * bits and it gets 16 x 16 bit multiplies instead.
+ */
+#ifdef PIXEL_FORMAT_U16
+typedef uint32_t pixel_scale_t;
+typedef uint16_t pixel_weight_t;
+#define SCALE_CHANNEL(v, a)  ((pixel_t) (((v) * (a) + 0x8000) >> 16))
+#define MERGE_CHANNEL(v1, v2, a1, a2) \
+  ((pixel_t) (((uint32_t) (v1) * (a1) + (uint32_t) (v2) * (a2) + 0x8000) >> 16))
+#else
+typedef pixel_t pixel_scale_t;
+typedef pixel_t pixel_weight_t;
+#define SCALE_CHANNEL(v, a)  ((v) * (a))
+#define MERGE_CHANNEL(v1, v2, a1, a2)  ((v1) * (a1) + (v2) * (a2))
+#endif
+
+
+static inline __attribute__ ((always_inline)) void
+framebuffer_dim_impl (pixel_t *restrict framebuffer,
+                      int               fb_size,
+                      pixel_scale_t     a)
 {
-  int i;
+  int n, i;
 
-  for (i = 0; i < 8 * 8 * 8 * 3; i++)
-    framebuffer[i] *= alpha;
+  for (n = 0; n + FRAMEBUFFER_BLOCK <= fb_size; n += FRAMEBUFFER_BLOCK)
+    {
+      for (i = 0; i < FRAMEBUFFER_BLOCK; i++)
+        framebuffer[n + i] = SCALE_CHANNEL (framebuffer[n + i], a);
+    }
+
+  for (; n < fb_size; n++)
+    framebuffer[n] = SCALE_CHANNEL (framebuffer[n], a);
 }
 
 
 void
-framebuffer_merge (double *fb,
-                   double *effect1,
-                   double *effect2,
-                   double alpha)
+framebuffer_dim (pixel_t            *framebuffer,
+                 const CubeGeometry *geom,
+                 double              alpha)
 {
-  int i;
+#ifdef PIXEL_FORMAT_U16
+  const uint32_t a = ROUND (CLAMP (alpha, 0.0, 1.0) * 65536.0);
+
+  framebuffer_dim_impl (framebuffer, geom->fb_size, a);
+#else
+  framebuffer_dim_impl (framebuffer, geom->fb_size, alpha);
+#endif
+}
+
 
-  for (i = 0; i < 8 * 8 * 8 * 3; i++)
+static inline __attribute__ ((always_inline)) void
+framebuffer_merge_impl (pixel_t       *restrict fb,
+                        int                     fb_size,
+                        const pixel_t *restrict effect1,
+                        const pixel_t *restrict effect2,
+                        pixel_weight_t          a1,
+                        pixel_weight_t          a2)
+{
+  int n, i;
+
+  for (n = 0; n + FRAMEBUFFER_BLOCK <= fb_size; n += FRAMEBUFFER_BLOCK)
     {
-      fb[i] = effect1[i] * (1.0 - alpha) + effect2[i] * alpha;
+      for (i = 0; i < FRAMEBUFFER_BLOCK; i++)
+        fb[n + i] = MERGE_CHANNEL (effect1[n + i], effect2[n + i], a1, a2);
     }
+
+  for (; n < fb_size; n++)
+    fb[n] = MERGE_CHANNEL (effect1[n], effect2[n], a1, a2);
+}
+
+
+/* fb must not be one of the effects */
+void
+framebuffer_merge (pixel_t            *fb,
+                   const CubeGeometry *geom,
+                   pixel_t            *effect1,
+                   pixel_t            *effect2,
+                   double              alpha)
+{
+#ifdef PIXEL_FORMAT_U16
+  const uint32_t a2 = ROUND (CLAMP (alpha, 0.0, 1.0) * 65536.0);
+
+  if (a2 == 0)
+    memcpy (fb, effect1, geom->fb_size * sizeof (pixel_t));
+  else if (a2 == 65536)
+    memcpy (fb, effect2, geom->fb_size * sizeof (pixel_t));
+  else
+    framebuffer_merge_impl (fb, geom->fb_size, effect1, effect2,
+                            65536 - a2, a2);
+#else
+  framebuffer_merge_impl (fb, geom->fb_size, effect1, effect2,
+                          1.0 - alpha, alpha);
+#endif
 }
 
 
@@ -242,27 +775,234 @@ euclid_3d (double x,
 }
 
 
-int
-read_png_file (char    *file_name,
-               int     *ret_width,
-               int     *ret_height,
-               int     *ret_rowstride,
-               double **ret_pixels)
+/*
+ * PNG decoding with the progressive libpng API: the file is fed in
+ * chunks and every row gets converted to the output format as soon as
+ * libpng hands it over, there is no full size 8 bit copy of the image.
+ * Only the rows in [row_start, row_end) are kept, for non-interlaced
+ * images decoding stops after the last one of them.  Interlaced images
+ * need their rows combined over all passes, they keep the raw rows of
+ * the range until the end.
+ */
+
+typedef struct
+{
+  ImageFormat  format;
+  int          row_start;
+  int          row_end;
+  int          width;
+  int          height;
+  int          channels;     /* 3 or 4 after the transforms */
+  int          bit_depth;    /* 8 or 16 after the transforms */
+  int          interlaced;
+  size_t       rowbytes;
+  uint8_t     *raw;          /* interlaced images only */
+  void        *pixels;
+  int          done;
+  int          error;        /* -errno for a failure of our own */
+} PngDecoder;
+
+
+static size_t
+image_format_size (ImageFormat format)
+{
+  switch (format)
+    {
+      case IMAGE_FORMAT_FLOAT:
+        return sizeof (float);
+      case IMAGE_FORMAT_DOUBLE:
+        return sizeof (double);
+      default:
+        return sizeof (uint8_t);
+    }
+}
+
+
+/* one row from libpng's layout to RGB in the output format, alpha gets
+ * composited onto black */
+static void
+png_decoder_convert_row (PngDecoder    *dec,
+                         const uint8_t *src,
+                         int            row)
+{
+  const int n = dec->width;
+  const int c = dec->channels;
+  size_t offset = (size_t) (row - dec->row_start) * n * 3;
+  int x, i;
+
+  if (dec->format == IMAGE_FORMAT_U8 && dec->bit_depth == 8)
+    {
+      uint8_t *dst = (uint8_t *) dec->pixels + offset;
+
+      if (c == 3)
+        {
+          memcpy (dst, src, n * 3);
+          return;
+        }
+
+      for (x = 0; x < n; x++)
+        {
+          for (i = 0; i < 3; i++)
+            dst[x * 3 + i] = (src[x * 4 + i] * src[x * 4 + 3] + 127) / 255;
+        }
+    }
+  else
+    {
+      const int max = dec->bit_depth == 16 ? 65535 : 255;
+
+      for (x = 0; x < n; x++)
+        {
+          double alpha = 1.0;
+          int v[4];
+
+          for (i = 0; i < c; i++)
+            {
+              if (dec->bit_depth == 16)
+                v[i] = (src[(x * c + i) * 2] << 8) | src[(x * c + i) * 2 + 1];
+              else
+                v[i] = src[x * c + i];
+            }
+
+          if (c == 4)
+            alpha = ((double) v[3]) / max;
+
+          for (i = 0; i < 3; i++)
+            {
+              double value = ((double) v[i]) / max * alpha;
+              size_t j = offset + x * 3 + i;
+
+              if (dec->format == IMAGE_FORMAT_U8)
+                ((uint8_t *) dec->pixels)[j] = value * 255.0 + 0.5;
+              else if (dec->format == IMAGE_FORMAT_FLOAT)
+                ((float *) dec->pixels)[j] = value;
+              else
+                ((double *) dec->pixels)[j] = value;
+            }
+        }
+    }
+}
+
+
+static void
+png_decoder_info (png_structp png_ptr,
+                  png_infop   info_ptr)
+{
+  PngDecoder *dec = png_get_progressive_ptr (png_ptr);
+  png_byte color_type, bit_depth;
+
+  color_type = png_get_color_type (png_ptr, info_ptr);
+  bit_depth = png_get_bit_depth (png_ptr, info_ptr);
+
+  /* everything becomes 8 or 16 bit RGB, optionally with alpha */
+  if (color_type == PNG_COLOR_TYPE_PALETTE)
+    png_set_palette_to_rgb (png_ptr);
+  if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8)
+    png_set_expand_gray_1_2_4_to_8 (png_ptr);
+  if (png_get_valid (png_ptr, info_ptr, PNG_INFO_tRNS))
+    png_set_tRNS_to_alpha (png_ptr);
+  if (color_type == PNG_COLOR_TYPE_GRAY ||
+      color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
+    png_set_gray_to_rgb (png_ptr);
+  /* with alpha the 16 bit values get premultiplied first and rounded
+   * once, otherwise 8 bit output can drop the low byte right away */
+  if (bit_depth == 16 && dec->format == IMAGE_FORMAT_U8 &&
+      !(color_type & PNG_COLOR_MASK_ALPHA) &&
+      !png_get_valid (png_ptr, info_ptr, PNG_INFO_tRNS))
+    png_set_strip_16 (png_ptr);
+
+  dec->interlaced = png_set_interlace_handling (png_ptr) > 1;
+  png_read_update_info (png_ptr, info_ptr);
+
+  dec->width = png_get_image_width (png_ptr, info_ptr);
+  dec->height = png_get_image_height (png_ptr, info_ptr);
+  dec->channels = png_get_channels (png_ptr, info_ptr);
+  dec->bit_depth = png_get_bit_depth (png_ptr, info_ptr);
+  dec->rowbytes = png_get_rowbytes (png_ptr, info_ptr);
+
+  if (dec->row_end < 0 || dec->row_end > dec->height)
+    dec->row_end = dec->height;
+  if (dec->row_start > dec->row_end)
+    dec->row_start = dec->row_end;
+
+  dec->pixels = calloc ((size_t) (dec->row_end - dec->row_start) *
+                        dec->width * 3 + 1,
+                        image_format_size (dec->format));
+
+  if (dec->interlaced)
+    dec->raw = calloc ((size_t) (dec->row_end - dec->row_start) + 1,
+                       dec->rowbytes);
+
+  if (!dec->pixels || (dec->interlaced && !dec->raw))
+    {
+      dec->error = -ENOMEM;
+      png_error (png_ptr, "out of memory");
+    }
+
+  if (dec->row_start == dec->row_end)
+    dec->done = 1;
+}
+
+
+static void
+png_decoder_row (png_structp png_ptr,
+                 png_bytep   new_row,
+                 png_uint_32 row_num,
+                 int         pass)
+{
+  PngDecoder *dec = png_get_progressive_ptr (png_ptr);
+
+  /* interlaced images pass NULL for rows without new pixels */
+  if (!new_row || row_num < dec->row_start || row_num >= dec->row_end)
+    return;
+
+  if (dec->interlaced)
+    {
+      png_progressive_combine_row (png_ptr,
+                                   dec->raw + (row_num - dec->row_start) *
+                                              dec->rowbytes,
+                                   new_row);
+      return;
+    }
+
+  png_decoder_convert_row (dec, new_row, row_num);
+
+  if (row_num + 1 == dec->row_end)
+    dec->done = 1;
+}
+
+
+static void
+png_decoder_end (png_structp png_ptr,
+                 png_infop   info_ptr)
 {
-  png_byte color_type;
-  png_byte bit_depth;
+  PngDecoder *dec = png_get_progressive_ptr (png_ptr);
 
+  dec->done = 1;
+}
+
+
+/* decodes rows [row_start, row_start + n_rows) of a PNG file, n_rows < 0
+ * for all remaining rows, to RGB in the given format.  ret_height is
+ * the height of the whole image, ret_pixels holds the requested rows
+ * only and ret_rowstride is in elements.  Returns 0 or -errno. */
+int
+read_png_rows (const char   *file_name,
+               ImageFormat   format,
+               int           row_start,
+               int           n_rows,
+               int          *ret_width,
+               int          *ret_height,
+               int          *ret_rowstride,
+               void        **ret_pixels)
+{
+  PngDecoder *dec;
   png_structp png_ptr;
   png_infop info_ptr;
-  png_bytep *row_pointers;
-  int x, y, width, height, rowstride;
-  uint8_t *pngpixels;
-  double *pixels;
-
-  uint8_t header[8];    // 8 is the maximum size that can be checked
+  uint8_t buf[65536];
+  size_t len;
+  int y, ret = 0;
   FILE *fp;
 
-  /* open file and test for it being a png */
   fp = fopen (file_name, "rb");
   if (!fp)
     {
@@ -271,8 +1011,8 @@ read_png_file (char    *file_name,
       return -ENOENT;
     }
 
-  if (fread (header, 1, 8, fp) < 8 ||
-      png_sig_cmp (header, 0, 8))
+  len = fread (buf, 1, 8, fp);
+  if (len < 8 || png_sig_cmp (buf, 0, 8))
     {
       fprintf (stderr, "File %s is not recognized as a PNG file\n",
                file_name);
@@ -280,9 +1020,7 @@ read_png_file (char    *file_name,
       return -EINVAL;
     }
 
-  /* initialize stuff */
   png_ptr = png_create_read_struct (PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-
   if (!png_ptr)
     {
       fprintf (stderr, "png_create_read_struct failed\n");
@@ -294,88 +1032,124 @@ read_png_file (char    *file_name,
   if (!info_ptr)
     {
       fprintf (stderr, "png_create_info_struct failed\n");
+      png_destroy_read_struct (&png_ptr, NULL, NULL);
       fclose (fp);
       return -ENOMEM;
     }
 
-  if (setjmp (png_jmpbuf (png_ptr)))
+  /* the callbacks change the decoder after setjmp (), a local of this
+   * frame would be indeterminate after the longjmp ().  It lives on the
+   * heap, only the pointer to it is local and that never changes. */
+  dec = calloc (1, sizeof (PngDecoder));
+  if (!dec)
     {
-      fprintf (stderr, "Error during init_io\n");
+      fprintf (stderr, "out of memory decoding %s\n", file_name);
+      png_destroy_read_struct (&png_ptr, &info_ptr, NULL);
       fclose (fp);
       return -ENOMEM;
     }
 
-  png_init_io (png_ptr, fp);
-  png_set_sig_bytes (png_ptr, 8);
-
-  png_read_info (png_ptr, info_ptr);
-
-  width = png_get_image_width (png_ptr, info_ptr);
-  height = png_get_image_height (png_ptr, info_ptr);
-  color_type = png_get_color_type (png_ptr, info_ptr);
-  bit_depth = png_get_bit_depth (png_ptr, info_ptr);
-
-  if (color_type != PNG_COLOR_TYPE_RGB || bit_depth != 8)
-    {
-      fprintf (stderr, "wrong PNG type\n");
-      fclose (fp);
-      return -EINVAL;
-    }
-
-  png_set_interlace_handling (png_ptr);
-  png_read_update_info (png_ptr, info_ptr);
+  dec->format = format;
+  dec->row_start = MAX (row_start, 0);
+  dec->row_end = n_rows < 0 ? -1 : dec->row_start + n_rows;
 
-  /* read file */
   if (setjmp (png_jmpbuf (png_ptr)))
     {
-      fprintf (stderr, "Error during read_image\n");
-      fclose (fp);
-      return -EIO;
+      fprintf (stderr, "Error decoding %s\n", file_name);
+      ret = dec->error ? dec->error : -EIO;
+      goto out;
     }
 
-  rowstride = png_get_rowbytes (png_ptr, info_ptr);
-  pngpixels = malloc (rowstride * height);
+  png_set_progressive_read_fn (png_ptr, dec,
+                               png_decoder_info,
+                               png_decoder_row,
+                               png_decoder_end);
 
-  row_pointers = malloc (sizeof (png_bytep) * height);
-  for (y = 0; y < height; y++)
-    {
-      row_pointers[y] = pngpixels + y * rowstride;
-    }
+  /* the signature bytes we already read */
+  png_process_data (png_ptr, info_ptr, buf, 8);
 
-  png_read_image (png_ptr, row_pointers);
+  while (!dec->done && (len = fread (buf, 1, sizeof (buf), fp)) > 0)
+    png_process_data (png_ptr, info_ptr, buf, len);
 
-  free (row_pointers);
-  fclose (fp);
-
-  pixels = malloc (sizeof (double) * width * height * 3);
-
-  for (y = 0; y < height; y++)
+  if (!dec->done)
     {
-      for (x = 0; x < width; x++)
-        {
-          // fprintf (stderr, "x: %d, y: %d\n", x, y);
-          pixels[(y * width + x) * 3 + 0] =
-              ((double) pngpixels[y * rowstride + x * 3 + 0]) / 255.0;
-          pixels[(y * width + x) * 3 + 1] =
-              ((double) pngpixels[y * rowstride + x * 3 + 1]) / 255.0;
-          pixels[(y * width + x) * 3 + 2] =
-              ((double) pngpixels[y * rowstride + x * 3 + 2]) / 255.0;
-        }
+      fprintf (stderr, "File %s is truncated\n", file_name);
+      ret = -EIO;
+      goto out;
     }
 
-  free (pngpixels);
+  for (y = 0; dec->interlaced && y < dec->row_end - dec->row_start; y++)
+    png_decoder_convert_row (dec, dec->raw + y * dec->rowbytes,
+                             dec->row_start + y);
+
+  *ret_width = dec->width;
+  *ret_height = dec->height;
+  *ret_rowstride = 3 * dec->width;
+  *ret_pixels = dec->pixels;
+  dec->pixels = NULL;
 
+out:
   png_destroy_read_struct (&png_ptr, &info_ptr, NULL);
+  fclose (fp);
+  free (dec->raw);
+  free (dec->pixels);
+  free (dec);
+
+  return ret;
+}
 
-  *ret_width = width;
-  *ret_height = height;
-  *ret_rowstride = 3 * width;
-  *ret_pixels = pixels;
 
-  return 0;
+/* the whole image as doubles */
+int
+read_png_file (char    *file_name,
+               int     *ret_width,
+               int     *ret_height,
+               int     *ret_rowstride,
+               double **ret_pixels)
+{
+  return read_png_rows (file_name, IMAGE_FORMAT_DOUBLE, 0, -1,
+                        ret_width, ret_height, ret_rowstride,
+                        (void **) ret_pixels);
 }
 
 
+/* bilinear interpolation between the four neighbours of (x, y), pixels
+ * outside of the image count as black.  The same code for every
+ * ImageFormat, scale maps the stored values to 0.0..1.0. */
+#define SAMPLE_BUFFER_BODY(scale)                                       \
+  int x0, y0, i, j, c;                                                  \
+  double dx, dy;                                                        \
+                                                                        \
+  x0 = floor (x);                                                       \
+  y0 = floor (y);                                                       \
+  dx = x - x0;                                                          \
+  dy = y - y0;                                                          \
+                                                                        \
+  ret_pixel[0] = 0.0;                                                   \
+  ret_pixel[1] = 0.0;                                                   \
+  ret_pixel[2] = 0.0;                                                   \
+                                                                        \
+  for (j = 0; j < 2; j++)                                               \
+    {                                                                   \
+      int yj = y0 + j;                                                  \
+      double wy = j ? dy : 1.0 - dy;                                    \
+                                                                        \
+      if (yj < 0 || yj >= height)                                       \
+        continue;                                                       \
+                                                                        \
+      for (i = 0; i < 2; i++)                                           \
+        {                                                               \
+          int xi = x0 + i;                                              \
+          double w = (i ? dx : 1.0 - dx) * wy * (scale);                \
+                                                                        \
+          if (xi < 0 || xi >= width)                                    \
+            continue;                                                   \
+                                                                        \
+          for (c = 0; c < 3; c++)                                       \
+            ret_pixel[c] += w * buffer[yj * rowstride + xi * 3 + c];    \
+        }                                                               \
+    }
+
 void
 sample_buffer (double  *buffer,
                int      width,
@@ -385,51 +1159,19 @@ sample_buffer (double  *buffer,
                double   y,
                double  *ret_pixel)
 {
-  int x0, y0;
-  double dx, dy;
-
-  x0 = floor (x);
-  y0 = floor (y);
-  dx = x - x0;
-  dy = y - y0;
-
-  ret_pixel[0] = 0.0;
-  ret_pixel[1] = 0.0;
-  ret_pixel[2] = 0.0;
-
-  if (x0 >= 0 && x0 < width && y0 >= 0 && y0 < height)
-    {
-      ret_pixel[0] += (1.0 - dx) * (1.0 - dy) * buffer[y0 * rowstride + x0 * 3 + 0];
-      ret_pixel[1] += (1.0 - dx) * (1.0 - dy) * buffer[y0 * rowstride + x0 * 3 + 1];
-      ret_pixel[2] += (1.0 - dx) * (1.0 - dy) * buffer[y0 * rowstride + x0 * 3 + 2];
-    }
-
-  x0 += 1;
-
-  if (x0 >= 0 && x0 < width && y0 >= 0 && y0 < height)
-    {
-      ret_pixel[0] += dx * (1.0 - dy) * buffer[y0 * rowstride + x0 * 3 + 0];
-      ret_pixel[1] += dx * (1.0 - dy) * buffer[y0 * rowstride + x0 * 3 + 1];
-      ret_pixel[2] += dx * (1.0 - dy) * buffer[y0 * rowstride + x0 * 3 + 2];
-    }
-
-  x0 -= 1;
-  y0 += 1;
-
-  if (x0 >= 0 && x0 < width && y0 >= 0 && y0 < height)
-    {
-      ret_pixel[0] += (1.0 - dx) * dy * buffer[y0 * rowstride + x0 * 3 + 0];
-      ret_pixel[1] += (1.0 - dx) * dy * buffer[y0 * rowstride + x0 * 3 + 1];
-      ret_pixel[2] += (1.0 - dx) * dy * buffer[y0 * rowstride + x0 * 3 + 2];
-    }
+  SAMPLE_BUFFER_BODY (1.0)
+}
 
-  x0 += 1;
 
-  if (x0 >= 0 && x0 < width && y0 >= 0 && y0 < height)
-    {
-      ret_pixel[0] += dx * dy * buffer[y0 * rowstride + x0 * 3 + 0];
-      ret_pixel[1] += dx * dy * buffer[y0 * rowstride + x0 * 3 + 1];
-      ret_pixel[2] += dx * dy * buffer[y0 * rowstride + x0 * 3 + 2];
-    }
+void
+sample_buffer_u8 (const uint8_t *buffer,
+                  int            width,
+                  int            height,
+                  int            rowstride,
+                  double         x,
+                  double         y,
+                  double        *ret_pixel)
+{
+  SAMPLE_BUFFER_BODY (1.0 / 255.0)
 }
 
@@ -1,5 +1,10 @@
+#ifndef __RENDER_UTILS_H__
+#define __RENDER_UTILS_H__
+
 #include <math.h>
 
+#include "pixel-format.h"
+
 #define MAX(x, y) ((x) > (y) ? (x) : (y))
 #define MIN(x, y) ((x) < (y) ? (x) : (y))
 #define ABS(x) ((x) >= 0 ? (x) : -(x))
@@ -7,7 +12,54 @@
 #define CLAMP(v, lo, hi) MAX (MIN ((v), (hi)), (lo))
 
 
-void pixel_set         (double *framebuffer,
+/*
+ * Layout of a cube in the framebuffer.  The order names the axes from
+ * the slowest to the fastest varying one, CUBE_ORDER_XYZ is
+ * (x * size_y + y) * size_z + z, the wiring of the original 8x8x8 cube.
+ * Strides are in pixels, a pixel is three consecutive channels.
+ */
+
+typedef enum
+{
+  CUBE_ORDER_XYZ,
+  CUBE_ORDER_XZY,
+  CUBE_ORDER_YXZ,
+  CUBE_ORDER_YZX,
+  CUBE_ORDER_ZXY,
+  CUBE_ORDER_ZYX,
+} CubeOrder;
+
+typedef struct
+{
+  int size_x, size_y, size_z;
+  int stride_x, stride_y, stride_z;
+  CubeOrder order;
+
+  int n_pixels;
+  int fb_size;     /* number of channels, n_pixels * 3 */
+  int fast_size;   /* edge length if a specialised kernel applies, else 0 */
+} CubeGeometry;
+
+#define CUBE_INDEX(geom, x, y, z) \
+  ((x) * (geom)->stride_x + (y) * (geom)->stride_y + (z) * (geom)->stride_z)
+
+/* the 8x8x8 cube all renderers were written for */
+extern const CubeGeometry cube_geometry_8;
+
+int  cube_geometry_init (CubeGeometry *geom,
+                         int           size_x,
+                         int           size_y,
+                         int           size_z,
+                         CubeOrder     order);
+
+int  cube_geometry_parse (CubeGeometry *geom,
+                          const char   *spec);
+
+int  cube_geometry_slabs (const CubeGeometry *geom);
+
+
+void pixel_set         (pixel_t            *framebuffer,
+                        const CubeGeometry *geom,
                         int x,
                         int y,
                         int z,
@@ -15,38 +67,85 @@ void pixel_set         (double *framebuffer,
                         double green,
                         double blue);
 
-void render_pixel      (double *framebuffer,
+void render_pixel      (pixel_t            *framebuffer,
+                        const CubeGeometry *geom,
                         int x, int y, int z,
                         double red, double green, double blue,
                         double alpha);
 
-void interpolate_pixel (double *framebuffer,
+void interpolate_pixel (pixel_t            *framebuffer,
+                        const CubeGeometry *geom,
                         double x, double y, double z,
                         double red, double green, double blue,
                         double alpha);
 
-void render_blob       (double *framebuffer,
+void render_blob       (pixel_t            *framebuffer,
+                        const CubeGeometry *geom,
+                        double cx, double cy, double cz,
+                        double red, double green, double blue,
+                        double r, double s);
+
+void render_blob_slab  (pixel_t            *framebuffer,
+                        const CubeGeometry *geom,
+                        int x_start, int x_end,
                         double cx, double cy, double cz,
                         double red, double green, double blue,
                         double r, double s);
 
-void framebuffer_set   (double *framebuffer,
-                        double  red,
-                        double  green,
-                        double  blue);
+/*
+ * Framebuffers for the kernels below, zeroed.  They work on any buffer,
+ * these ones are aligned so the vectorized loops get aligned accesses.
+ */
+#define FRAMEBUFFER_ALIGN 64
+#define FRAMEBUFFER_BLOCK 96   /* channels per kernel block, 32 pixels */
+
+pixel_t * framebuffer_new  (const CubeGeometry *geom);
+void      framebuffer_free (pixel_t            *fb);
 
-void framebuffer_dim   (double *framebuffer,
-                        double  alpha);
+void framebuffer_set   (pixel_t            *framebuffer,
+                        const CubeGeometry *geom,
+                        double              red,
+                        double              green,
+                        double              blue);
 
-void framebuffer_merge (double *fb,
-                        double *effect1,
-                        double *effect2,
-                        double  alpha);
+void framebuffer_set_slab (pixel_t            *framebuffer,
+                           const CubeGeometry *geom,
+                           int                 x_start,
+                           int                 x_end,
+                           double              red,
+                           double              green,
+                           double              blue);
+
+void framebuffer_dim   (pixel_t            *framebuffer,
+                        const CubeGeometry *geom,
+                        double              alpha);
+
+void framebuffer_merge (pixel_t            *fb,
+                        const CubeGeometry *geom,
+                        pixel_t            *effect1,
+                        pixel_t            *effect2,
+                        double              alpha);
 
 double euclid_3d       (double x,
                         double y,
                         double z);
 
+typedef enum
+{
+  IMAGE_FORMAT_U8,
+  IMAGE_FORMAT_FLOAT,
+  IMAGE_FORMAT_DOUBLE,
+} ImageFormat;
+
+int read_png_rows      (const char   *file_name,
+                        ImageFormat   format,
+                        int           row_start,
+                        int           n_rows,
+                        int          *width,
+                        int          *height,
+                        int          *rowstride,
+                        void        **pixels);
+
 int read_png_file      (char    *file_name,
                         int     *width,
                         int     *height,
@@ -61,3 +160,12 @@ void sample_buffer     (double  *buffer,
                         double   y,
                         double  *ret_pixel);
 
+void sample_buffer_u8  (const uint8_t *buffer,
+                        int            width,
+                        int            height,
+                        int            rowstride,
+                        double         x,
+                        double         y,
+                        double        *ret_pixel);
+
+#endif
@@ -1,52 +1,70 @@
+#include <stdio.h>
+#include <stdlib.h>
+
 #include "opc-client.h"
 #include "render-utils.h"
+#include "frame-scheduler.h"
 #include "renderer_astern.h"
 
+#define FPS 20.0
+
+/* how fast the search goes does not depend on FPS */
+#define STEPS_PER_SECOND 10.0
+#define STEP_BUDGET      0.005
+#define PATH_TIME        2.0
+
 int
 main (int   argc,
       char *argv[])
 {
-  double *framebuffer;
+  pixel_t *framebuffer;
   OpcClient *client;
-  struct timeval tv;
+  const CubeGeometry *geom = &cube_geometry_8;
+  FrameScheduler *sched;
+  double t_finished = 0.0;
   int finished = 0;
 
 
-  framebuffer = calloc (8 * 8 * 8 * 3, sizeof (double));
+  framebuffer = calloc (geom->fb_size, sizeof (pixel_t));
 
   client = opc_client_new ("localhost:7890", 7890,
-                           8 * 8 * 8 * 3,
+                           geom->fb_size,
                            framebuffer);
 
   opc_client_connect (client);
 
-  while(1) {
-  framebuffer_set(framebuffer, 0.0,0.0,0.0);
-  init();
-  finished = 0;
+  sched = frame_scheduler_new (FPS);
+
+  framebuffer_set (framebuffer, geom, 0.0, 0.0, 0.0);
+  init_astern (geom);
 
-  while (!finished)
+  while (1)
     {
-      
       double t;
-      gettimeofday (&tv, NULL);
-      t = tv.tv_sec * 1.0 + tv.tv_usec / 1000000.0;
 
- 	render_map(framebuffer);
-	finished = astern_step();
+      t = frame_scheduler_wait (sched);
+
+      if (!finished)
+        {
+          finished = astern_step_to (t, STEPS_PER_SECOND, STEP_BUDGET);
+          render_map (framebuffer, geom);
+          render_path (framebuffer, geom);
+          t_finished = t;
+        }
+      else if (t - t_finished >= PATH_TIME)
+        {
+          framebuffer_set (framebuffer, geom, 0.0, 0.0, 0.0);
+          init_astern (geom);
+          finished = 0;
+        }
 
       opc_client_write (client, 0, 0);
-      usleep (100 * 1000);  /* 50ms */
     }
-   
-  render_path(framebuffer);
-  opc_client_write (client, 0, 0);
-  sleep(2);
-  destruct();
-  }
+
+  destruct_astern ();
+  frame_scheduler_free (sched);
   opc_client_shutdown (client);
 
   return 0;
 
 }
-
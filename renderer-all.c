@@ -3,11 +3,17 @@
 #include <string.h>
 #include <unistd.h>
 #include <math.h>
+#include <signal.h>
 #include <netinet/in.h>
-#include <sys/time.h>
 
 #include "opc-client.h"
 #include "render-utils.h"
+#include "frame-scheduler.h"
+#include "image-cache.h"
+#include "sample-map.h"
+#include "compositor.h"
+#include "render-pool.h"
+#include "render-stats.h"
 
 #include <fcntl.h>
 #include <poll.h>
@@ -18,94 +24,239 @@
 #include "renderer_pong.h"
 
 #define EFFECT_TIME 30.0
+#define DEFAULT_FPS 20.0
 
-typedef void (*RenderFunc) (double *, double);
+/* split: renders the slab it gets, nothing else, and keeps no state */
+typedef struct
+{
+  const char *name;
+  RenderFunc  render;
+  int         split;
+  Histogram  *hist;
+} RenderMode;
+
+/* what the frame scheduler and the OPC client count, in the stats */
+enum
+{
+  COUNTER_MISSED,
+  COUNTER_SKIPPED,
+  COUNTER_MAX_LATE,
+  COUNTER_PUBLISHED,
+  COUNTER_SENT,
+  COUNTER_DROPPED,
+  COUNTER_UNCHANGED,
+  COUNTER_BYTES_SENT,
+  COUNTER_BYTES_SAVED,
+  N_COUNTERS
+};
+
+static const char *counter_names[N_COUNTERS] =
+{
+  "deadlines missed",
+  "deadlines skipped",
+  "max late us",
+  "frames published",
+  "frames sent",
+  "frames dropped",
+  "frames unchanged",
+  "bytes sent",
+  "bytes saved",
+};
+
+
+static void
+update_counters (RenderStats    *stats,
+                 FrameScheduler *sched,
+                 OpcClient      *client)
+{
+  FrameSchedulerStats sched_stats;
+  OpcClientStats client_stats;
+
+  frame_scheduler_get_stats (sched, &sched_stats);
+  opc_client_get_stats (client, &client_stats);
+
+  render_stats_set_counter (stats, COUNTER_MISSED, sched_stats.missed);
+  render_stats_set_counter (stats, COUNTER_SKIPPED, sched_stats.skipped);
+  render_stats_set_counter (stats, COUNTER_MAX_LATE,
+                            sched_stats.max_late * 1000000.0);
+  render_stats_set_counter (stats, COUNTER_PUBLISHED,
+                            client_stats.frames_published);
+  render_stats_set_counter (stats, COUNTER_SENT, client_stats.frames_sent);
+  render_stats_set_counter (stats, COUNTER_DROPPED,
+                            client_stats.frames_dropped);
+  render_stats_set_counter (stats, COUNTER_UNCHANGED,
+                            client_stats.frames_skipped);
+  render_stats_set_counter (stats, COUNTER_BYTES_SENT,
+                            client_stats.bytes_sent);
+  render_stats_set_counter (stats, COUNTER_BYTES_SAVED,
+                            client_stats.bytes_saved);
+}
 
 
-void
-mode_import_png (double *fb,
-                 double  t)
+/* the panel the flat modes paint, pixel i at column i % cols and row
+ * i / cols: 32x16 on the 8x8x8 cube, 4 columns per x and 2 rows per y
+ * in general, as far as the framebuffer holds them */
+static void
+panel_size (const CubeGeometry *geom,
+            int                *cols,
+            int                *rows)
 {
-  double *pixels, *cfp;
-  int width, height, rowstride;
-  int x, y;
-  double x1, y1, x2, y2, angle;
+  *cols = 4 * geom->size_x;
+  *rows = MIN (2 * geom->size_y, geom->n_pixels / *cols);
+}
 
-  if (read_png_file ("swirl.png",
-                     &width, &height, &rowstride, &pixels) < 0)
-    {
-      fprintf (stderr, "failed to read PNG\n");
-      return;
-    }
 
-  if (width < 32 || height < 31)
-    {
-      fprintf (stderr, "PNG not big enough\n");
-      return;
-    }
+/* blacks out the pixels behind the panel */
+static void
+panel_clear_rest (pixel_t            *fb,
+                  const CubeGeometry *geom,
+                  int                 n_panel)
+{
+  int i;
 
-  for (y = 0; y < 16; y++)
-    {
-      for (x = 0; x < 32; x++)
-        {
-          cfp = fb + (y * 32 + x) * 3;
+  for (i = n_panel * 3; i < geom->fb_size; i++)
+    fb[i] = 0;
+}
 
-#if 0
-          x1 = x * 0.5;
-          y1 = y + (x % 2) * 0.5;
 
-          x1 -= 16;
-          y1 -= 16;
+void
+mode_import_png (pixel_t            *fb,
+                 const CubeGeometry *geom,
+                 double              t,
+                 int                 x_start,
+                 int                 x_end)
+{
+  static SampleMap *map = NULL;
+  static int map_cols = 0, map_rows = 0;
+  SampleTransform transform = SAMPLE_TRANSFORM_IDENTITY;
+  const Image *image;
+  int width, height;
+  int cols, rows;
+  int row_start, n_rows;
+
+  panel_size (geom, &cols, &rows);
+  if (rows < 1)
+    return;
+
+  /* the panel positions in image coordinates before the transform, the
+   * indices and weights for them only get computed when the transform
+   * changes */
+  if (!map || map_cols != cols || map_rows != rows)
+    {
+      int x, y;
 
-          y1 += 3;
+      if (map)
+        sample_map_free (map);
 
-          angle = fmod (t / 16, 2 * M_PI);
-          x2 = cos (angle) * x1 - sin (angle) * y1;
-          y2 = sin (angle) * x1 + cos (angle) * y1;
-          x1 = x2;
-          y1 = y2;
+      map = sample_map_new (cols * rows);
+      if (!map)
+        return;
 
-          x1 += fmod (t, 3 * EFFECT_TIME) * (width + 32) / (3 * EFFECT_TIME);
-          x1 -= 32;
+      map_cols = cols;
+      map_rows = rows;
 
-          x1 += 16;
-          y1 += 16;
+      for (y = 0; y < rows; y++)
+        {
+          for (x = 0; x < cols; x++)
+            {
+#if 0
+              sample_map_set_point (map, y * cols + x,
+                                    x * 0.5 - cols / 2,
+                                    y + (x % 2) * 0.5 - (rows - 3));
 #else
-          x1 = 15 + (x + 0) / 2 - y;
-          y1 = 30 - (x + 1) / 2 - y;
+              sample_map_set_point (map, y * cols + x,
+                                    (x + 0) / 2 - y,
+                                    -((x + 1) / 2) - y);
 #endif
-
-          sample_buffer (pixels, width, height, rowstride, x1, y1, cfp);
+            }
         }
     }
 
-  free (pixels);
+#if 0
+  {
+    double angle, scroll;
+
+    angle = fmod (t / 16, 2 * M_PI);
+    scroll = fmod (t, 3 * EFFECT_TIME) * (width + cols) / (3 * EFFECT_TIME);
+
+    transform.xx = cos (angle);
+    transform.xy = -sin (angle);
+    transform.yx = sin (angle);
+    transform.yy = cos (angle);
+    transform.x0 = scroll - cols + cols / 2;
+    transform.y0 = cols / 2;
+  }
+#else
+  /* 15, 30 for the 8x8x8 panel: its top left corner at the origin */
+  transform.x0 = rows - 1;
+  transform.y0 = cols / 2 + rows - 2;
+#endif
+
+  /* decoded once, only gets reloaded when the file changes or the
+   * panel needs rows that weren't decoded yet */
+  sample_map_rows (map, &transform, &row_start, &n_rows);
+  image = image_cache_get_rows ("swirl.png", row_start, n_rows);
+  if (!image)
+    return;
+
+  width = image->width;
+  height = image->height;
+
+  /* 32x31 for the 8x8x8 panel */
+  if (width < cols || height < cols / 2 + rows - 1)
+    {
+      fprintf (stderr, "PNG not big enough\n");
+      image_unref (image);
+      return;
+    }
+
+  /* the decoded rows are an image of their own, starting at row_start */
+  transform.y0 -= image->row_start;
+  sample_map_update (map, &transform, width, image->n_rows,
+                     image->rowstride);
+  sample_map_apply_u8 (map, image->pixels, fb);
+  panel_clear_rest (fb, geom, cols * rows);
+
+  image_unref (image);
 }
 
 
 void
-mode_radar_scan (double *fb,
-                 double  t)
+mode_radar_scan (pixel_t            *fb,
+                 const CubeGeometry *geom,
+                 double              t,
+                 int                 x_start,
+                 int                 x_end)
 {
+  double cx, cy, radius;
+  int cols, rows;
   int i;
 
-  for (i = 0; i < 512; i++)
+  panel_size (geom, &cols, &rows);
+
+  /* 7.75, 7.75 and 8 for the 8x8x8 panel, the odd columns sit half a
+   * row lower */
+  cx = (cols - 1) / 4.0;
+  cy = (rows - 1) / 2.0 + 0.25;
+  radius = MIN (cols / 4.0, rows / 2.0);
+
+  for (i = 0; i < cols * rows; i++)
     {
       double x, y, phi, r, alpha;
 
-      x = (i % 32) / 2.0           - 7.75;
-      y = (i / 32) + (i % 2) * 0.5 - 7.75;
+      x = (i % cols) / 2.0             - cx;
+      y = (i / cols) + (i % 2) * 0.5   - cy;
 
       phi = fmod (M_PI * 2 + atan2 (y, x) + t, M_PI * 2);
       r = hypot (x, y);
 
-      if (r < 8.5)
+      if (r < radius + 0.5)
         {
-          alpha = r < 7.5 ? 1.0 : 8.5 - r;
+          alpha = r < radius - 0.5 ? 1.0 : radius + 0.5 - r;
           phi = MAX (2.0 - phi, 0.0) / 2.0;
-          fb[i*3 + 0] = 1.0 * phi * alpha;;
-          fb[i*3 + 1] = (0.4 + 0.6 * phi) * alpha;
-          fb[i*3 + 2] = 1.0 * phi * alpha;
+          fb[i*3 + 0] = PIXEL_FROM_DOUBLE (1.0 * phi * alpha);
+          fb[i*3 + 1] = PIXEL_FROM_DOUBLE ((0.4 + 0.6 * phi) * alpha);
+          fb[i*3 + 2] = PIXEL_FROM_DOUBLE (1.0 * phi * alpha);
         }
       else
         {
@@ -114,38 +265,47 @@ mode_radar_scan (double *fb,
           fb[i*3 + 2] = 0;
         }
     }
+
+  panel_clear_rest (fb, geom, cols * rows);
 }
 
 
 void
-mode_jumping_pixels (double *fb,
-                     double  t)
+mode_jumping_pixels (pixel_t            *fb,
+                     const CubeGeometry *geom,
+                     double              t,
+                     int                 x_start,
+                     int                 x_end)
 {
+  /* modes render concurrently, none may touch the drand48 () state */
+  static unsigned short xsubi[3] = { 0x330e, 0x1234, 0x0001 };
   static double *offsets = NULL;
+  const double h = geom->size_z - 1;
   int i, x, y;
 
   if (!offsets)
     {
-      offsets = malloc (64 * sizeof (double));
-      for (i = 0; i < 64; i++)
+      offsets = malloc (geom->size_x * geom->size_y * sizeof (double));
+      for (i = 0; i < geom->size_x * geom->size_y; i++)
         {
-          offsets[i] = drand48 () * 7 - 3.5;
+          offsets[i] = erand48 (xsubi) * h - h / 2;
         }
     }
 
-  framebuffer_set (fb, 0.0, 0.3, 0.0);
+  framebuffer_set (fb, geom, 0.0, 0.3, 0.0);
 
-  for (x = 0; x < 8; x++)
+  for (x = 0; x < geom->size_x; x++)
     {
-      for (y = 0; y < 8; y++)
+      for (y = 0; y < geom->size_y; y++)
         {
           double z;
 
-          z = CLAMP (sin (t) * 7 + offsets[x * 8 + y] + 3.5 , 0.0, 6.99);
+          z = CLAMP (sin (t) * h + offsets[x * geom->size_y + y] + h / 2,
+                     0.0, h - 0.01);
 
-          render_pixel (fb, x, y, 1 + (int) z,
+          render_pixel (fb, geom, x, y, 1 + (int) z,
                         1.0, 1.0, 1.0, z - (int) z);
-          render_pixel (fb, x, y, (int) z,
+          render_pixel (fb, geom, x, y, (int) z,
                         1.0, 1.0, 1.0, 1.0 - (z - (int) z));
         }
     }
@@ -153,115 +313,141 @@ mode_jumping_pixels (double *fb,
 
 
 void
-mode_lava_balloon (double *fb,
-                   double  t)
+mode_lava_balloon (pixel_t            *fb,
+                   const CubeGeometry *geom,
+                   double              t,
+                   int                 x_start,
+                   int                 x_end)
 {
+  const double scale = geom->size_z / 8.0;
   int X, Y;
 
-  framebuffer_set (fb, 0.0, 0.0, 0.4);
+  framebuffer_set_slab (fb, geom, x_start, x_end, 0.0, 0.0, 0.4);
 
-  for (X = 0; X < 8; X++)
+  for (X = x_start; X < x_end; X++)
     {
-      for (Y = 0; Y < 8; Y++)
+      for (Y = 0; Y < geom->size_y; Y++)
         {
           double x, y, r, z;
-          x = (((double) X) / 7.0 - 0.5) * 0.8 *  M_PI;
-          y = (((double) Y) / 7.0 - 0.5) * 0.8 * M_PI;
+          x = (((double) X) / (geom->size_x - 1) - 0.5) * 0.8 *  M_PI;
+          y = (((double) Y) / (geom->size_y - 1) - 0.5) * 0.8 * M_PI;
           r = pow (x * x + y * y, 0.5);
-          z = sin (r + t) * 0.7 + 0.7;
+          z = (sin (r + t) * 0.7 + 0.7) * scale;
 
-          render_pixel (fb, X, Y, 1 + (int) z,
+          render_pixel (fb, geom, X, Y, 1 + (int) z,
                         1.0, 0.0, 0.0, z - (int) z);
-          render_pixel (fb, X, Y, (int) z,
+          render_pixel (fb, geom, X, Y, (int) z,
                         1.0, 0.0, 0.0, 1.0 - (z - (int) z));
         }
     }
 
-  render_blob (fb,
-               0.875, 0.875, fmod (t, 4.0) - 1.0,
-               1.0, 1.0, 0.0,
-               0.75, 1.0);
+  render_blob_slab (fb, geom, x_start, x_end,
+                    0.875, 0.875, fmod (t, 4.0) - 1.0,
+                    1.0, 1.0, 0.0,
+                    0.75, 1.0);
 }
 
 
 void
-mode_random_blips (double *fb,
-                   double  t)
+mode_random_blips (pixel_t            *fb,
+                   const CubeGeometry *geom,
+                   double              t,
+                   int                 x_start,
+                   int                 x_end)
 {
+  /* modes render concurrently, this one has its own random state */
+  static unsigned short xsubi[3] = { 0x330e, 0xabcd, 0x0002 };
   int x, y, z, i;
-  framebuffer_dim (fb, 0.99);
+  framebuffer_dim (fb, geom, 0.99);
 
   for (i = 0; i < 5; i++)
     {
-      x = random () % 8;
-      y = random () % 8;
-      z = random () % 8;
+      double red, green, blue;
 
-      pixel_set (fb, x, y, z,
-                 drand48 (), drand48 (), drand48 ());
+      x = nrand48 (xsubi) % geom->size_x;
+      y = nrand48 (xsubi) % geom->size_y;
+      z = nrand48 (xsubi) % geom->size_z;
+      red = erand48 (xsubi);
+      green = erand48 (xsubi);
+      blue = erand48 (xsubi);
+
+      pixel_set (fb, geom, x, y, z, red, green, blue);
     }
 }
 
 
+/* the search runs at the same speed at any frame rate, one step per
+ * frame at the default one, but takes at most 2 ms of a frame */
+#define ASTERN_STEPS_PER_SECOND DEFAULT_FPS
+#define ASTERN_STEP_BUDGET      0.002
+#define ASTERN_PATH_TIME        0.5
+
 void
-mode_astern (double *framebuffer,
-             double  t)
+mode_astern (pixel_t            *framebuffer,
+             const CubeGeometry *geom,
+             double              t,
+             int                 x_start,
+             int                 x_end)
 {
-  static int wait_counter = -1;    // wait when finished
-  static int finished_astern = 0;  //
+  static int finished_astern = 0;
   static int initiated_astern = 0;
+  static double t_finished = 0.0;
 
   if (!initiated_astern)
     {
       initiated_astern = 1;
-      init_astern ();
+      init_astern (geom);
     }
 
   if (!finished_astern)
     {
-      render_map (framebuffer);
-      finished_astern = astern_step ();
+      finished_astern = astern_step_to (t, ASTERN_STEPS_PER_SECOND,
+                                        ASTERN_STEP_BUDGET);
+      render_map (framebuffer, geom);
+      t_finished = t;
+
       if (finished_astern < 0)
         {
-          // fail, no route found
+          // fail, no route found, flash and start over
 
-          wait_counter = 0;
-          framebuffer_set (framebuffer, 1.0, 1.0, 1.0);
+          framebuffer_set (framebuffer, geom, 1.0, 1.0, 1.0);
+          init_astern (geom);
+          finished_astern = 0;
         }
      }
+   else if (t - t_finished < ASTERN_PATH_TIME)
+     {
+       render_path (framebuffer, geom);
+     }
    else
      {
-       if (wait_counter < 0)
-         wait_counter = 9;
-
-       if (wait_counter > 0)
-         {
-           render_path (framebuffer);
-           wait_counter--;
-         }
-       else
-         {
-           // == 0
-           destruct_astern ();
-           initiated_astern = 0;
-           finished_astern = 0;
-           wait_counter = -1;
-         }
+       // a new search in the same nodes
+       init_astern (geom);
+       finished_astern = 0;
      }
 }
 
 void
-mode_ball_wave (double *fb,
-                double  t)
+mode_ball_wave (pixel_t            *fb,
+                const CubeGeometry *geom,
+                double              t,
+                int                 x_start,
+                int                 x_end)
 {
-  render_ball (t,fb);
+  render_ball_slab (t, fb, geom, x_start, x_end);
 }
 
 
 void
-mode_rect_flip (double *fb,
-                double  t)
+mode_rect_flip (pixel_t            *fb,
+                const CubeGeometry *geom,
+                double              t,
+                int                 x_start,
+                int                 x_end)
 {
+  const double ex = geom->size_x - 1;
+  const double ey = geom->size_y - 1;
+  const double ez = geom->size_z - 1;
   int x, y, z;
   double dt, sdt, cdt;
   double nx, ny, nz, a;
@@ -282,13 +468,13 @@ mode_rect_flip (double *fb,
         nx = + sdt;
         ny = 0;
         nz = - cdt;
-        a = 7.0 * (nx + nz);
+        a = ex * nx + ez * nz;
         break;
       case 1:
         nx = + cdt;
         ny = + sdt;
         nz = 0;
-        a = 7.0 * nx;
+        a = ex * nx;
         break;
       case 2:
         nx = 0;
@@ -306,25 +492,25 @@ mode_rect_flip (double *fb,
         nx = - cdt;
         ny = - sdt;
         nz = 0;
-        a = 7.0 * ny;
+        a = ey * ny;
         break;
       case 5:
         nx = 0;
         ny = - cdt;
         nz = + sdt;
-        a = 7.0 * (ny + nz);
+        a = ey * ny + ez * nz;
         break;
       default:
         break;
     }
 
-  framebuffer_set (fb, 0.2, 0.0, 0.0);
+  framebuffer_set_slab (fb, geom, x_start, x_end, 0.2, 0.0, 0.0);
 
-  for (x = 0; x < 7.99; x++)
+  for (x = x_start; x < x_end; x++)
     {
-      for (y = 0; y < 7.99; y++)
+      for (y = 0; y < geom->size_y; y++)
         {
-          for (z = 0; z < 7.99; z++)
+          for (z = 0; z < geom->size_z; z++)
             {
               double d, len;
 
@@ -333,10 +519,10 @@ mode_rect_flip (double *fb,
               switch (pos)
                 {
                   case 0:
-                    len = sqrt ((7.0 - x) * (7.0 - x) + (7.0 - z) * (7.0 - z));
+                    len = sqrt ((ex - x) * (ex - x) + (ez - z) * (ez - z));
                     break;
                   case 1:
-                    len = sqrt ((7.0 - x) * (7.0 - x) + y * y);
+                    len = sqrt ((ex - x) * (ex - x) + y * y);
                     break;
                   case 2:
                     len = sqrt (y * y + z * z);
@@ -345,10 +531,10 @@ mode_rect_flip (double *fb,
                     len = sqrt (x * x + z * z);
                     break;
                   case 4:
-                    len = sqrt (x * x + (7.0 - y) * (7.0 - y));
+                    len = sqrt (x * x + (ey - y) * (ey - y));
                     break;
                   case 5:
-                    len = sqrt ((7.0 - y) * (7.0 - y) + (7.0 - z) * (7.0 - z));
+                    len = sqrt ((ey - y) * (ey - y) + (ez - z) * (ez - z));
                     break;
                   default:
                     len = 0;
@@ -357,8 +543,8 @@ mode_rect_flip (double *fb,
 
               if (d < 0.7)
                 {
-                  len = 1.0 - CLAMP (len - 7.0, 0.0, 1.0);
-                  render_pixel (fb, x, y, z, 1.0, 0.8, 0.0, len * (1.0 - d));
+                  len = 1.0 - CLAMP (len - ex, 0.0, 1.0);
+                  render_pixel (fb, geom, x, y, z, 1.0, 0.8, 0.0, len * (1.0 - d));
                 }
             }
         }
@@ -366,42 +552,105 @@ mode_rect_flip (double *fb,
 }
 
 
+/*
+ * Paints a mode into a layer, and a second one into another layer when
+ * b isn't NULL, both at the same time.  The only exception is the same
+ * mode twice (when there's just one): one that keeps state can't run
+ * concurrently with itself.
+ */
+static void
+render_modes (RenderPool         *pool,
+              const CubeGeometry *geom,
+              double              t,
+              const RenderMode   *a,
+              Layer              *layer_a,
+              const RenderMode   *b,
+              Layer              *layer_b)
+{
+  RenderJob jobs[2] = { { a->render, layer_a->pixels, a->split, a->hist }, };
+
+  if (b)
+    {
+      jobs[1].func = b->render;
+      jobs[1].fb = layer_b->pixels;
+      jobs[1].split = b->split;
+      jobs[1].hist = b->hist;
+    }
+
+  if (b && b->render == a->render && !a->split)
+    {
+      render_pool_render (pool, geom, t, jobs + 0, 1);
+      render_pool_render (pool, geom, t, jobs + 1, 1);
+    }
+  else
+    {
+      render_pool_render (pool, geom, t, jobs, b ? 2 : 1);
+    }
+
+  layer_mark_dirty (layer_a);
+  if (b)
+    layer_mark_dirty (layer_b);
+}
+
+
 int
 main (int   argc,
       char *argv[])
 {
-  double *framebuffer;
-  double *effect1, *effect2;
-  struct timeval tv;
+  pixel_t *framebuffer;
+  Compositor *comp;
+  Layer *current, *next, *pong;
+  FrameScheduler *sched;
+  RenderPool *pool;
   OpcClient *client;
+  RenderStats *stats;
+  Histogram *render_fade, *render_single, *composite, *frame_time;
+  CubeGeometry geom = cube_geometry_8;
   int mode = 0;
   int have_flip = 0;
+  int i;
   int input_fd = -1;
   struct pollfd pfd;
   double joy_x, joy_y, joy_active;
-  double last_js_test = 0;
+  double last_js_test = -10.0;  /* look for a joystick right away */
 
-  RenderFunc modeptrs[] =
+  RenderMode modeptrs[] =
     {
-      // mode_astern,
-      mode_lava_balloon,
-      mode_jumping_pixels,
-      mode_import_png,
-      mode_random_blips,
-      mode_rect_flip,
-      mode_ball_wave,
-      mode_radar_scan,
+      // { "astern",         mode_astern,         0 },
+      { "lava balloon",   mode_lava_balloon,   1 },
+      { "jumping pixels", mode_jumping_pixels, 0 },
+      { "import png",     mode_import_png,     0 },
+      { "random blips",   mode_random_blips,   0 },
+      { "rect flip",      mode_rect_flip,      1 },
+      { "ball wave",      mode_ball_wave,      1 },
+      { "radar scan",     mode_radar_scan,     0 },
     };
 
   int num_modes = sizeof (modeptrs) / sizeof (modeptrs[0]);
 
-  framebuffer = calloc (8 * 8 * 8 * 3, sizeof (double));
-  effect1 = calloc (8 * 8 * 8 * 3, sizeof (double));
-  effect2 = calloc (8 * 8 * 8 * 3, sizeof (double));
+  if (argc > 3 && !cube_geometry_parse (&geom, argv[3]))
+    exit (1);
+
+  sched = frame_scheduler_new (argc > 4 ? atof (argv[4]) : DEFAULT_FPS);
+  if (!sched)
+    exit (1);
+
+  /* the effects get rendered on this many threads, 0 is one per CPU */
+  pool = render_pool_new (argc > 5 ? atoi (argv[5]) : 1);
+
+  framebuffer = framebuffer_new (&geom);
+
+  /* the running mode, the next one fading in over it during the first
+   * second of an effect, and pong on top while a joystick is active */
+  comp = compositor_new (&geom);
+  current = compositor_add_layer (comp, BLEND_OVER, 1.0);
+  next = compositor_add_layer (comp, BLEND_OVER, 0.0);
+  pong = compositor_add_layer (comp, BLEND_OVER, 1.0);
+  layer_set_visible (pong, 0);
 
   client = opc_client_new (argc > 1 ? argv[1] : "127.0.0.1:7890", 15163,
                            // "balldachin.hasi:7890", 7890,
-                           8 * 8 * 8 * 3,
+                           geom.fb_size,
                            framebuffer);
 
   if (!client)
@@ -409,7 +658,20 @@ main (int   argc,
       fprintf (stderr, "can't open client\n");
       exit (1);
     }
+
+  /* a single OPC message can't carry a 32x32x32 cube, send one
+   * channel per slab along the slowest axis instead */
+  if (geom.fb_size > 0xffff)
+    {
+      int n_slabs = cube_geometry_slabs (&geom);
+      int slab_size, i;
+
+      slab_size = geom.fb_size / n_slabs;
+      for (i = 0; i < n_slabs; i++)
+        opc_client_add_channel (client, i + 1, i * slab_size, slab_size);
+    }
   opc_client_connect (client);
+  opc_client_start_async (client);
 
   if (argc > 2)
     {
@@ -422,11 +684,39 @@ main (int   argc,
         }
     }
 
+  /* SIGUSR1 dumps the stats to stderr, with a sixth argument they are
+   * also served on a Unix socket of that name */
+  stats = render_stats_new ();
+
+  for (i = 0; i < num_modes; i++)
+    {
+      char name[64];
+
+      snprintf (name, sizeof (name), "mode %s", modeptrs[i].name);
+      modeptrs[i].hist = render_stats_add_stage (stats, name, NULL);
+    }
+
+  render_fade = render_stats_add_stage (stats, "render fade", NULL);
+  render_single = render_stats_add_stage (stats, "render single", NULL);
+  composite = render_stats_add_stage (stats, "composite", NULL);
+  render_stats_add_stage (stats, "quantize", &client->quantize_time);
+  render_stats_add_stage (stats, "send", &client->send_time);
+  frame_time = render_stats_add_stage (stats, "frame", NULL);
+
+  for (i = 0; i < N_COUNTERS; i++)
+    render_stats_add_counter (stats, counter_names[i]);
+
+  render_stats_dump_on (SIGUSR1);
+  if (argc > 6)
+    render_stats_listen (stats, argv[6]);
+
   while (1)
     {
-      double t, dt;
-      gettimeofday (&tv, NULL);
-      t = tv.tv_sec * 1.0 + tv.tv_usec / 1000000.0;
+      const pixel_t *frame;
+      double t, dt, t_render, t_composite, t_send;
+      int fading = 0;
+
+      t = frame_scheduler_wait (sched);
 
       if (input_fd < 0 && t - last_js_test > 5)
         {
@@ -485,52 +775,81 @@ main (int   argc,
         }
 
       dt = fmod (t, EFFECT_TIME);
+      t_render = frame_scheduler_now (sched);
 
       if (!joy_active)
         {
+          layer_set_visible (pong, 0);
+
           if (dt < 1.0)
             {
               if (have_flip == 1)
                 {
-                  memset (effect2, 0, sizeof (double) * 8 * 8 * 8 * 3);
+                  framebuffer_set (next->pixels, &geom, 0.0, 0.0, 0.0);
                   have_flip = 0;
                 }
 
-              modeptrs[(mode + 0) % num_modes] (effect1, t);
-              modeptrs[(mode + 1) % num_modes] (effect2, t);
+              layer_set_opacity (next, dt);
 
-              framebuffer_merge (framebuffer, effect1, effect2, dt);
+              /* the incoming mode only costs something while it shows */
+              render_modes (pool, &geom, t,
+                            &modeptrs[(mode + 0) % num_modes], current,
+                            dt > 0.0 ? &modeptrs[(mode + 1) % num_modes] : NULL,
+                            next);
+
+              fading = dt > 0.0;
             }
           else
             {
               if (have_flip == 0)
                 {
-                  double *tmp;
-
-                  tmp = effect1;
-                  effect1 = effect2;
-                  effect2 = tmp;
+                  /* the faded in mode becomes the current one */
+                  layer_swap_pixels (current, next);
                   mode += 1;
                   mode %= num_modes;
 
                   have_flip = 1;
                 }
 
-              modeptrs[(mode + 0) % num_modes] (effect1, t);
-              framebuffer_merge (framebuffer, effect1, effect2, 0.0);
+              /* the outgoing mode is gone, current alone makes the
+               * frame and goes out without being blended or copied */
+              layer_set_opacity (next, 0.0);
+              render_modes (pool, &geom, t,
+                            &modeptrs[(mode + 0) % num_modes], current,
+                            NULL, NULL);
             }
         }
       else
         {
-          render_pong (t, effect1, joy_x, joy_y);
-          framebuffer_merge (framebuffer, effect1, effect2, 0.0);
+          render_pong (t, pong->pixels, &geom, joy_x, joy_y);
+          layer_mark_dirty (pong);
+          layer_set_visible (pong, 1);
         }
 
+      t_composite = frame_scheduler_now (sched);
+      frame = compositor_render (comp, framebuffer);
+      t_send = frame_scheduler_now (sched);
+
+      /* the client quantizes before opc_client_write () returns, so
+       * it may as well read straight from a layer */
+      opc_client_set_framebuffer (client, geom.fb_size, (pixel_t *) frame);
       opc_client_write (client, 0, 0);
-      usleep (50 * 1000);  /* 50ms */
+
+      histogram_record (fading ? render_fade : render_single,
+                        t_composite - t_render);
+      histogram_record (composite, t_send - t_composite);
+      histogram_record (frame_time, frame_scheduler_now (sched) - t_render);
+
+      render_stats_frame_done (stats);
+      update_counters (stats, sched, client);
+      render_stats_poll (stats);
     }
 
+  frame_scheduler_free (sched);
   opc_client_shutdown (client);
+  compositor_free (comp);
+  render_pool_free (pool);
+  render_stats_free (stats);
 
   return 0;
 }
@@ -1,29 +1,37 @@
+#include <stdio.h>
+#include <stdlib.h>
 
 #include "opc-client.h"
 #include "render-utils.h"
+#include "frame-scheduler.h"
 #include "renderer_ball.h"
 
+#define FPS 20.0
+
 int
 main (int   argc,
       char *argv[])
 {
-  double *framebuffer;
+  pixel_t *framebuffer;
   OpcClient *client;
-  struct timeval tv;
+  const CubeGeometry *geom = &cube_geometry_8;
+  FrameScheduler *sched;
 
-  framebuffer = calloc (8 * 8 * 8 * 3, sizeof (double));
+  framebuffer = framebuffer_new (geom);
 
   client = opc_client_new ("localhost:7890", 7890,
-                           8 * 8 * 8 * 3,
+                           geom->fb_size,
                            framebuffer);
 
   opc_client_connect (client);
 
+  sched = frame_scheduler_new (FPS);
+
   while (1)
     {
       double t;
-      gettimeofday (&tv, NULL);
-      t = tv.tv_sec * 1.0 + tv.tv_usec / 1000000.0;
+
+      t = frame_scheduler_wait (sched);
 
 //      render_wave (t, framebuffer);
       // framebuffer_set (framebuffer, 0.0, 0.0, 0.3);
@@ -32,12 +40,12 @@ main (int   argc,
                    1.0, 1.0, 0.0,
                    0.75, 1.0);
  */
- 	render_ball(t, framebuffer);
+ 	render_ball(t, framebuffer, geom);
 
       opc_client_write (client, 0, 0);
-      usleep (50 * 1000);  /* 50ms */
     }
 
+  frame_scheduler_free (sched);
   opc_client_shutdown (client);
 
   return 0;
@@ -3,45 +3,49 @@
 #include <unistd.h>
 #include <math.h>
 #include <netinet/in.h>
-#include <sys/time.h>
 
 #include "opc-client.h"
 #include "render-utils.h"
+#include "frame-scheduler.h"
 
 #define EFFECT_TIME 30.0
+#define FPS 20.0
 
-typedef void (*RenderFunc) (double *, double);
+typedef void (*RenderFunc) (pixel_t *, const CubeGeometry *, double);
 
 
 void
-mode_jumping_pixels (double *fb,
-                     double  t)
+mode_jumping_pixels (pixel_t            *fb,
+                     const CubeGeometry *geom,
+                     double              t)
 {
   static double *offsets = NULL;
+  const double h = geom->size_z - 1;
   int i, x, y;
 
   if (!offsets)
     {
-      offsets = malloc (64 * sizeof (double));
-      for (i = 0; i < 64; i++)
+      offsets = malloc (geom->size_x * geom->size_y * sizeof (double));
+      for (i = 0; i < geom->size_x * geom->size_y; i++)
         {
-          offsets[i] = drand48 () * 7 - 3.5;
+          offsets[i] = drand48 () * h - h / 2;
         }
     }
 
-  framebuffer_set (fb, 0.0, 0.3, 0.0);
+  framebuffer_set (fb, geom, 0.0, 0.3, 0.0);
 
-  for (x = 0; x < 8; x++)
+  for (x = 0; x < geom->size_x; x++)
     {
-      for (y = 0; y < 8; y++)
+      for (y = 0; y < geom->size_y; y++)
         {
           double z;
 
-          z = CLAMP (sin (t) * 7 + offsets[x * 8 + y] + 3.5 , 0.0, 6.99);
+          z = CLAMP (sin (t) * h + offsets[x * geom->size_y + y] + h / 2,
+                     0.0, h - 0.01);
 
-          render_pixel (fb, x, y, 1 + (int) z,
+          render_pixel (fb, geom, x, y, 1 + (int) z,
                         1.0, 1.0, 1.0, z - (int) z);
-          render_pixel (fb, x, y, (int) z,
+          render_pixel (fb, geom, x, y, (int) z,
                         1.0, 1.0, 1.0, 1.0 - (z - (int) z));
         }
     }
@@ -49,31 +53,33 @@ mode_jumping_pixels (double *fb,
 
 
 void
-mode_lava_balloon (double *fb,
-                   double  t)
+mode_lava_balloon (pixel_t            *fb,
+                   const CubeGeometry *geom,
+                   double              t)
 {
+  const double scale = geom->size_z / 8.0;
   int X, Y;
 
-  framebuffer_set (fb, 0.0, 0.0, 0.4);
+  framebuffer_set (fb, geom, 0.0, 0.0, 0.4);
 
-  for (X = 0; X < 8; X++)
+  for (X = 0; X < geom->size_x; X++)
     {
-      for (Y = 0; Y < 8; Y++)
+      for (Y = 0; Y < geom->size_y; Y++)
         {
           double x, y, r, z;
-          x = (((double) X) / 7.0 - 0.5) * 0.8 *  M_PI;
-          y = (((double) Y) / 7.0 - 0.5) * 0.8 * M_PI;
+          x = (((double) X) / (geom->size_x - 1) - 0.5) * 0.8 *  M_PI;
+          y = (((double) Y) / (geom->size_y - 1) - 0.5) * 0.8 * M_PI;
           r = pow (x * x + y * y, 0.5);
-          z = sin (r + t) * 0.7 + 0.7;
+          z = (sin (r + t) * 0.7 + 0.7) * scale;
 
-          render_pixel (fb, X, Y, 1 + (int) z,
+          render_pixel (fb, geom, X, Y, 1 + (int) z,
                         1.0, 0.0, 0.0, z - (int) z);
-          render_pixel (fb, X, Y, (int) z,
+          render_pixel (fb, geom, X, Y, (int) z,
                         1.0, 0.0, 0.0, 1.0 - (z - (int) z));
         }
     }
 
-  render_blob (fb,
+  render_blob (fb, geom,
                0.875, 0.875, fmod (t, 4.0) - 1.0,
                1.0, 1.0, 0.0,
                0.75, 1.0);
@@ -81,19 +87,20 @@ mode_lava_balloon (double *fb,
 
 
 void
-mode_random_blips (double *fb,
-                   double t)
+mode_random_blips (pixel_t            *fb,
+                   const CubeGeometry *geom,
+                   double              t)
 {
   int x, y, z, i;
-  framebuffer_dim (fb, 0.99);
+  framebuffer_dim (fb, geom, 0.99);
 
   for (i = 0; i < 5; i++)
     {
-      x = random () % 8;
-      y = random () % 8;
-      z = random () % 8;
+      x = random () % geom->size_x;
+      y = random () % geom->size_y;
+      z = random () % geom->size_z;
 
-      pixel_set (fb, x, y, z,
+      pixel_set (fb, geom, x, y, z,
                  drand48 (), drand48 (), drand48 ());
     }
 }
@@ -103,10 +110,11 @@ int
 main (int   argc,
       char *argv[])
 {
-  double *framebuffer;
-  double *effect1, *effect2;
+  pixel_t *framebuffer;
+  pixel_t *effect1, *effect2;
   OpcClient *client;
-  struct timeval tv;
+  const CubeGeometry *geom = &cube_geometry_8;
+  FrameScheduler *sched;
   int mode = 0;
   int have_flip = 0;
   RenderFunc modeptrs[] =
@@ -118,37 +126,39 @@ main (int   argc,
 
   int num_modes = sizeof (modeptrs) / sizeof (modeptrs[0]);
 
-  framebuffer = calloc (8 * 8 * 8 * 3, sizeof (double));
-  effect1 = calloc (8 * 8 * 8 * 3, sizeof (double));
-  effect2 = calloc (8 * 8 * 8 * 3, sizeof (double));
+  framebuffer = framebuffer_new (geom);
+  effect1 = framebuffer_new (geom);
+  effect2 = framebuffer_new (geom);
 
   client = opc_client_new ("localhost:7890", 7890,
-                           8 * 8 * 8 * 3,
+                           geom->fb_size,
                            framebuffer);
 
   opc_client_connect (client);
 
+  sched = frame_scheduler_new (FPS);
+
   while (1)
     {
       double t, dt;
-      gettimeofday (&tv, NULL);
-      t = tv.tv_sec * 1.0 + tv.tv_usec / 1000000.0;
+
+      t = frame_scheduler_wait (sched);
 
       dt = fmod (t, EFFECT_TIME);
 
       if (dt < 1.0)
         {
-          modeptrs[(mode + 0) % num_modes] (effect1, t);
-          modeptrs[(mode + 1) % num_modes] (effect2, t);
+          modeptrs[(mode + 0) % num_modes] (effect1, geom, t);
+          modeptrs[(mode + 1) % num_modes] (effect2, geom, t);
 
-          framebuffer_merge (framebuffer, effect1, effect2, dt);
+          framebuffer_merge (framebuffer, geom, effect1, effect2, dt);
           have_flip = 0;
         }
       else
         {
           if (have_flip == 0)
             {
-              double *tmp;
+              pixel_t *tmp;
 
               tmp = effect1;
               effect1 = effect2;
@@ -159,14 +169,14 @@ main (int   argc,
               have_flip = 1;
             }
 
-          modeptrs[(mode + 0) % num_modes] (effect1, t);
-          framebuffer_merge (framebuffer, effect1, effect2, 0.0);
+          modeptrs[(mode + 0) % num_modes] (effect1, geom, t);
+          framebuffer_merge (framebuffer, geom, effect1, effect2, 0.0);
         }
 
       opc_client_write (client, 0, 0);
-      usleep (50 * 1000);  /* 50ms */
     }
 
+  frame_scheduler_free (sched);
   opc_client_shutdown (client);
 
   return 0;
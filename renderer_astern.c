@@ -1,311 +1,580 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>
+#include <string.h>
 #include <math.h>
-#include <netinet/in.h>
-#include <sys/time.h>
+#include <time.h>
 
-#include "opc-client.h"
+#include "frame-scheduler.h"
 #include "render-utils.h"
 
 #include "renderer_astern.h"
+#include "wall-map.h"
 
-struct Node** set;
+/* every array of the arena starts on a cache line */
+#define ARENA_ALIGN 64
+#define ARENA_SIZE(n, type) \
+  (((n) * sizeof (type) + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN)
 
-struct Node dest = { Unseen, 0.0,0.0, 0,0,0, 0};
-struct Node start = { Open, -1.0,-1.0, 7,7,7, 0};
+/* expansions between looks at the clock, one takes well below 1 us */
+#define BUDGET_CHECK_STEPS 64
 
+/* the search behind init_astern () and friends */
+static Astern *single = NULL;
 
-double cost_est(const Node_t* const n){
-	if (n->pc >=0)
-		return n->d + n->pc;
-	else 
-		return n->d;
+
+static void
+node_position (const Astern *astern,
+               int           i,
+               int          *x,
+               int          *y,
+               int          *z)
+{
+  *z = i % astern->size_z;
+  i /= astern->size_z;
+  *y = i % astern->size_y;
+  *x = i / astern->size_y;
+}
+
+
+float
+astern_manhattan (int dx,
+                  int dy,
+                  int dz)
+{
+  return dx + dy + dz;
+}
+
+
+float
+astern_euclid (int dx,
+               int dy,
+               int dz)
+{
+  return euclid_3d (dx, dy, dz);
 }
 
-void cpy_node_vals(const Node_t* const src, Node_t* const dst) {
-    dst->state = src->state;
-    dst->x = src->x;
-    dst->y = src->y;
-    dst->z = src->z;
-    dst->d = src->d;
-    dst->pc = src->pc;
-    dst->route_from = src->route_from;
+
+float
+astern_dijkstra (int dx,
+                 int dy,
+                 int dz)
+{
+  return 0.0;
 }
 
-int node_at_pos(const Node_t* const a, const double x, const double y, const double z) {
-	return a->x == x && a->y == y && a->z == z;
+
+static float
+node_estimate (const Astern *astern,
+               int           i)
+{
+  int x, y, z;
+
+  node_position (astern, i, &x, &y, &z);
+
+  return astern->heuristic (abs (x - astern->dest_x),
+                            abs (y - astern->dest_y),
+                            abs (z - astern->dest_z));
 }
 
-int node_same_pos(const Node_t* const a, const Node_t* const b) {
-	return node_at_pos(a, b->x, b->y, b->z);
+
+/* lower estimated total cost first, on a tie the one closer to dest */
+static int
+entry_before (const AsternEntry *a,
+              const AsternEntry *b)
+{
+  return a->f < b->f || (a->f == b->f && a->h < b->h);
 }
 
 
-int node_is_neigh(struct Node* a, struct Node* neigh) {
-   return 1 == abs(a->x - neigh->x) + abs(a->y - neigh->y) + abs(a->z - neigh->z);
+static void
+heap_place (Astern            *astern,
+            const AsternEntry *entry,
+            int                i)
+{
+  astern->heap[i] = *entry;
+  astern->heap_index[entry->node] = i;
 }
 
 
-Node_t* dst_node() {
- int i;
- for(i=0; i < NUM; i++) {
-    if (node_same_pos(set[i], &dest))
-	    return set[i];
- }
- return 0;
+static void
+heap_sift_up (Astern *astern,
+              int     i)
+{
+  AsternEntry entry = astern->heap[i];
+
+  while (i > 0)
+    {
+      int parent = (i - 1) / 2;
+
+      if (!entry_before (&entry, &astern->heap[parent]))
+        break;
+
+      heap_place (astern, &astern->heap[parent], i);
+      i = parent;
+    }
+
+  heap_place (astern, &entry, i);
+}
+
+
+static void
+heap_sift_down (Astern *astern,
+                int     i)
+{
+  AsternEntry entry = astern->heap[i];
+
+  while (1)
+    {
+      int child = 2 * i + 1;
+
+      if (child >= astern->n_open)
+        break;
+
+      if (child + 1 < astern->n_open &&
+          entry_before (&astern->heap[child + 1], &astern->heap[child]))
+        child++;
+
+      if (!entry_before (&astern->heap[child], &entry))
+        break;
+
+      heap_place (astern, &astern->heap[child], i);
+      i = child;
+    }
+
+  heap_place (astern, &entry, i);
+}
+
+
+static void
+heap_push (Astern *astern,
+           int     node,
+           float   h)
+{
+  AsternEntry entry = { astern->cost[node] + h, h, node };
+
+  heap_place (astern, &entry, astern->n_open++);
+  heap_sift_up (astern, astern->n_open - 1);
+}
+
+
+static int
+heap_pop (Astern *astern)
+{
+  int node = astern->heap[0].node;
+
+  astern->n_open--;
+  if (astern->n_open > 0)
+    {
+      heap_place (astern, &astern->heap[astern->n_open], 0);
+      heap_sift_down (astern, 0);
+    }
+
+  return node;
+}
+
+
+/* the walls of the wall map, a word at a time */
+static void
+astern_copy_walls (Astern *astern)
+{
+  const WallMap *walls = astern->walls;
+  const int slab_cells = astern->size_y * astern->size_z;
+  int x, w;
+
+  for (x = 0; x < astern->size_x; x++)
+    {
+      for (w = 0; w < walls->slab_words; w++)
+        {
+          uint64_t word = walls->bits[x * walls->slab_words + w];
+
+          while (word)
+            {
+              int bit = w * 64 + __builtin_ctzll (word);
+
+              astern->state[x * slab_cells + bit] = Wall;
+              word &= word - 1;
+            }
+        }
+    }
+}
+
+
+Astern *
+astern_new (const CubeGeometry *geom)
+{
+  const int n = geom->n_pixels;
+  Astern *astern;
+  uint8_t *arena;
+
+  astern = calloc (1, sizeof (Astern));
+  if (!astern)
+    {
+      perror ("astern_new");
+      return NULL;
+    }
+
+  astern->size_x = geom->size_x;
+  astern->size_y = geom->size_y;
+  astern->size_z = geom->size_z;
+  astern->n_nodes = n;
+  astern->dest = 0;
+  astern->start = n - 1;
+  astern->heuristic = astern_manhattan;
+  node_position (astern, astern->dest,
+                 &astern->dest_x, &astern->dest_y, &astern->dest_z);
+
+  astern->walls = wall_map_new (geom->size_x, geom->size_y, geom->size_z);
+  if (!astern->walls)
+    {
+      free (astern);
+      return NULL;
+    }
+
+  if (posix_memalign (&astern->arena, ARENA_ALIGN,
+                      ARENA_SIZE (n, uint8_t) +
+                      3 * ARENA_SIZE (n, int32_t) +
+                      ARENA_SIZE (n, AsternEntry)) != 0)
+    {
+      perror ("posix_memalign");
+      wall_map_free (astern->walls);
+      free (astern);
+      return NULL;
+    }
+
+  arena = astern->arena;
+  astern->state = (uint8_t *) arena;
+  arena += ARENA_SIZE (n, uint8_t);
+  astern->cost = (int32_t *) arena;
+  arena += ARENA_SIZE (n, int32_t);
+  astern->parent = (int32_t *) arena;
+  arena += ARENA_SIZE (n, int32_t);
+  astern->heap_index = (int32_t *) arena;
+  arena += ARENA_SIZE (n, int32_t);
+  astern->heap = (AsternEntry *) arena;
+
+  astern_reset (astern);
+
+  return astern;
 }
 
-void print_dists() 
-  { int i;
-  for (i=0; i<NUM; i++) 
-	  printf("%f\n", set[i]->d);
-  }
-
-int cmp_dst(const void* aa, const void* bb) {
-	Node_t* a;
-	Node_t* b;
-	a = *(Node_t**) aa;
-	b = *(Node_t**) bb;
-
-	if(cost_est(a) < cost_est(b)) 
-		return -1;
-	if(cost_est(a) > cost_est(b)) 
-		return 1;
-	return 0;
+
+/* the walls of the following searches depend on nothing else */
+void
+astern_set_seed (Astern   *astern,
+                 uint64_t  seed)
+{
+  wall_map_seed (astern->walls, seed);
 }
 
-int cmp_est_cost(const void* a, const void*b) {
-	int ca, cb;
-	ca=cost_est(a);
-	cb=cost_est(b);
-	if (ca < cb) return 1;
-	if (ca > cb) return -1;	
-	return 0;
+
+/* takes effect with the next astern_reset () */
+void
+astern_set_heuristic (Astern          *astern,
+                      AsternHeuristic  heuristic)
+{
+  astern->heuristic = heuristic ? heuristic : astern_manhattan;
 }
 
-void destruct_astern() {
- int i;
- for (i = 0; i < NUM ; i++) {
-	free(set[i]);	 
- 	set[i] = 0;
- }
- free(set);
- set = 0;
+
+/* new walls, with a route through them, and the search starts over.
+ * Only the node states get cleared, cost and parent of a node count
+ * once it has been seen. */
+void
+astern_reset (Astern *astern)
+{
+  memset (astern->state, Unseen, astern->n_nodes);
+  astern->n_open = 0;
+  astern->n_expanded = 0;
+  astern->result = 0;
+  astern->t_start = -1.0;
+  astern->n_advanced = 0;
+
+  wall_map_generate (astern->walls, astern->start, astern->dest);
+  astern_copy_walls (astern);
+
+  astern->state[astern->start] = Open;
+  astern->cost[astern->start] = 0;
+  astern->parent[astern->start] = -1;
+  heap_push (astern, astern->start, node_estimate (astern, astern->start));
 }
 
-void setRandomWall(int height, int width, char ortho) 
+
+static void
+astern_relax (Astern *astern,
+              int     from,
+              int     node)
 {
- int i, o_off, h_off, w_off;
- // select random offset on ortho axis 
- // select offset of height
- // select offset of width
- o_off = (lrand48()+SIZE) % SIZE;
- h_off = (lrand48()+SIZE-height) % (SIZE - height);
- w_off = (lrand48()+SIZE-width) % (SIZE - width);
-
- if(ortho == 'r') 
-	 ortho = lrand48() % 6;
-
- for (i=0; i<NUM ; i++) {
-    Node_t* n = set[i];
-    if( node_same_pos(n,&dest)
-     || node_same_pos(n, &start)) continue;
-    switch (ortho) {
-    case 0:
-    case 'x': if( n->x == o_off 
-               && n->y > h_off
-	       && n->y <= h_off + width 
-	       && n->z > w_off 
-	       && n->z <= w_off + width )
-    		  n->state = Wall;
-	break;
-    case 1:
-    case 'y':  if( n->y == o_off 
-               && n->z > h_off
-	       && n->z <= h_off + width 
-	       && n->x > w_off 
-	       && n->x <= w_off + width )
-    		  n->state = Wall;
-	break;
-    case 2:
-    case 'z':  if( n->z == o_off 
-               && n->x > h_off
-	       && n->x <= h_off + width 
-	       && n->y > w_off 
-	       && n->y <= w_off + width )
-    		  n->state = Wall;
-	break;
-    case 3:
-    case 'X': if( n->x == o_off 
-               && n->z > h_off
-	       && n->z <= h_off + width 
-	       && n->y > w_off 
-	       && n->y <= w_off + width )
-    		  n->state = Wall;
-	break;
-    case 4:
-    case 'Y':  if( n->y == o_off 
-               && n->x > h_off
-	       && n->x <= h_off + width 
-	       && n->z > w_off 
-	       && n->z <= w_off + width )
-    		  n->state = Wall;
-	break;
-    case 5:
-    case 'Z':  if( n->z == o_off 
-               && n->y > h_off
-	       && n->y <= h_off + width 
-	       && n->x > w_off 
-	       && n->x <= w_off + width )
-    		  n->state = Wall;
+  int32_t cost = astern->cost[from] + 1;
+
+  switch (astern->state[node])
+    {
+      case Unseen:
+        astern->state[node] = Open;
+        astern->cost[node] = cost;
+        astern->parent[node] = from;
+        heap_push (astern, node, node_estimate (astern, node));
         break;
 
+      case Open:
+        if (cost < astern->cost[node])
+          {
+            int i = astern->heap_index[node];
+
+            astern->cost[node] = cost;
+            astern->parent[node] = from;
+            astern->heap[i].f = cost + astern->heap[i].h;
+            heap_sift_up (astern, i);
+          }
+        break;
+
+      default:
+        break;
     }
- }
-	
-}	
-
-void init_astern() {
-  double x,y,z;
-  start.d = euclid_3d(start.x - dest.x, start.y - dest.y, start.z - dest.z);
-  start.pc = 0;
-  set = malloc(sizeof(struct Node*) * NUM);
-  for (x = 0; x < 8; x++)
+}
+
+
+/* expands the cheapest open node.  Returns 0 while searching, 1 once
+ * dest is reached and -1 when there is no route. */
+int
+astern_expand (Astern *astern)
+{
+  const int stride_x = astern->size_y * astern->size_z;
+  const int stride_y = astern->size_z;
+  int node, x, y, z;
+
+  if (astern->result != 0)
+    return astern->result;
+
+  if (astern->n_open == 0)
+    return astern->result = -1;
+
+  /* dest stays open, it gets shown like that */
+  if (astern->heap[0].node == astern->dest)
+    return astern->result = 1;
+
+  node = heap_pop (astern);
+  astern->state[node] = Closed;
+  astern->n_expanded++;
+  node_position (astern, node, &x, &y, &z);
+
+  if (x > 0)
+    astern_relax (astern, node, node - stride_x);
+  if (x < astern->size_x - 1)
+    astern_relax (astern, node, node + stride_x);
+  if (y > 0)
+    astern_relax (astern, node, node - stride_y);
+  if (y < astern->size_y - 1)
+    astern_relax (astern, node, node + stride_y);
+  if (z > 0)
+    astern_relax (astern, node, node - 1);
+  if (z < astern->size_z - 1)
+    astern_relax (astern, node, node + 1);
+
+  return 0;
+}
+
+
+void
+astern_render_map (Astern             *astern,
+                   pixel_t            *fb,
+                   const CubeGeometry *geom)
+{
+  int x, y, z, i = 0;
+
+  for (x = 0; x < astern->size_x; x++)
     {
-      for (y = 0; y < 8; y++)
+      for (y = 0; y < astern->size_y; y++)
         {
-          for (z = 0; z < 8; z++)
+          for (z = 0; z < astern->size_z; z++, i++)
             {
-              struct Node* n = 0;
-	      int i = 8*8*x + 8*y + z;
-	      n = malloc(sizeof(struct Node));
-	      if(node_at_pos(&dest, x,y,z)) // is destination
-		  cpy_node_vals(&dest, n);
-	      else if(node_at_pos(&start, x,y,z)) // is start 
-		  cpy_node_vals(&start, n);
-	      else {
- 	     	  n->state = Unseen;
-	     	  n->x = x;
-	     	  n->y = y;
-	     	  n->z = z;
-	     	  n->d = euclid_3d(x-dest.x,y-dest.y,z-dest.z);
-		  n->pc= euclid_3d(start.x-x, start.y-y, start.z-z);
-		  n->route_from = 0;
-	      }
-	      set[i] = n;
+              double red = 0.0, green = 0.0, blue = 0.0;
+
+              if (i == astern->start || i == astern->dest)
+                {
+                  red = 1.0;
+                }
+              else
+                {
+                  switch (astern->state[i])
+                    {
+                      case Unseen:
+                        red = 0.1;
+                        green = blue = 0.3;
+                        break;
+                      case Wall:
+                        red = 0.9;
+                        green = 0.9;
+                        break;
+                      case Open:
+                        green = 1.0;
+                        break;
+                      case Closed:
+                        blue = 1.0;
+                        break;
+                    }
+                }
+
+              pixel_set (fb, geom, x, y, z, red, green, blue);
             }
         }
     }
-  // sort set by d
-  //void qsort(void *base, size_t nmemb, size_t size,
-  //                    int (*compar)(const void *, const void *));
-//  print_dists();
-//  printf("--------------------\n");
-  qsort(&set[0], NUM, sizeof(Node_t*), cmp_est_cost);
-  //print_dists();
-  // Set Wall 1
-/*  for (i=0; i<NUM ; i++) {
-     Node_t* n = set[i];
-//     if(n->x == 2 && n->z < 7 && n->y <= 6)
-//	     n->state = Wall;
-     if(n->x == 6 && n->z > 3 && n->y >= 0)
-	     n->state = Wall;
-  }
-*/
-  setRandomWall(7,7, 'x');
-  setRandomWall(3,4, 'r');
-  setRandomWall(2,2, 'r');
-  setRandomWall(6,3, 'r');
-  setRandomWall(4, 5, 'r');
 }
 
 
+/* up to max_steps expansions (no limit if <= 0) within budget seconds
+ * (none if <= 0).  Returns what the last astern_expand () did. */
+int
+astern_expand_budget (Astern *astern,
+                      int     max_steps,
+                      double  budget)
+{
+  double deadline = budget > 0.0 ? monotonic_now () + budget : 0.0;
+  int i, result = astern->result;
 
-int astern_step() {
-// find closest open Node (n)
- Node_t* n = 0;
- Node_t* neigh[6] = {0};
- int i, found;
- for(i = 0; i < NUM && n == 0; i++) {
-    if(set[i]->state == Open) {
-	    n = set[i];
-	    break;
+  for (i = 0; result == 0 && (max_steps <= 0 || i < max_steps); i++)
+    {
+      if (deadline > 0.0 && i > 0 && i % BUDGET_CHECK_STEPS == 0 &&
+          monotonic_now () >= deadline)
+        break;
+
+      result = astern_expand (astern);
     }
- }
-if(!n) return -1; 
-// if n is dest -> juchuu
- if(node_same_pos(n, &dest)) 
-	 return 1;
-// else set n Closed
- n->state = Closed;
-// find Unseen neighbours of n (horrendously innefficient)
- for(i = 0, found=0; i < NUM && found < 7; i++) {
-   if(node_is_neigh(n, set[i]) && (set[i]->state == Open || set[i]->state == Unseen)) {
-	   neigh[found] = set[i];
-// set neighbours to open
-           neigh[found]->state = Open;
- 	   neigh[found]->pc = n->pc + 1;
-// set from to n
-	   neigh[found]->route_from = n;
-	   found++;
-   }
- }
-// sort for total cost
-// done.
- qsort(set, NUM, sizeof(Node_t*), cmp_est_cost);
- return 0;
+
+  return result;
 }
 
 
+/* the expansions due at time t since the first call after a reset.
+ * Whatever budget cuts off stays due, a slow frame gets caught up.
+ * The steps due are counted from the start, not summed up per frame,
+ * so none get lost to rounding. */
+int
+astern_advance (Astern *astern,
+                double  t,
+                double  steps_per_second,
+                double  budget)
+{
+  int n_steps, n_before;
 
+  if (steps_per_second <= 0.0)
+    return astern->result;
 
+  /* a new rate goes on from the steps made so far */
+  if (astern->t_start < 0.0 || t < astern->t_start ||
+      steps_per_second != astern->steps_per_second)
+    {
+      astern->t_start = t - astern->n_advanced / steps_per_second;
+      astern->steps_per_second = steps_per_second;
+    }
+
+  n_steps = (int) ((t - astern->t_start) * steps_per_second) -
+            astern->n_advanced;
+  if (n_steps <= 0 || astern->result != 0)
+    return astern->result;
 
+  n_before = astern->n_expanded;
+  astern_expand_budget (astern, n_steps, budget);
+  astern->n_advanced += astern->n_expanded - n_before;
+
+  return astern->result;
+}
 
-void render_map(double* fb)
+
+/* steps from start to dest, -1 until a route is found */
+int
+astern_path_length (Astern *astern)
+{
+  return astern->result == 1 ? astern->cost[astern->dest] : -1;
+}
+
+
+/* the route found, from dest back to start, in white */
+void
+astern_render_path (Astern             *astern,
+                    pixel_t            *fb,
+                    const CubeGeometry *geom)
+{
+  int node;
+
+  if (astern->result != 1)
+    return;
+
+  for (node = astern->parent[astern->dest];
+       node >= 0 && node != astern->start;
+       node = astern->parent[node])
+    {
+      int x, y, z;
+
+      node_position (astern, node, &x, &y, &z);
+      pixel_set (fb, geom, x, y, z, 1.0, 1.0, 1.0);
+    }
+}
+
+
+void
+astern_free (Astern *astern)
+{
+  wall_map_free (astern->walls);
+  free (astern->arena);
+  free (astern);
+}
+
+
+void
+init_astern (const CubeGeometry *geom)
+{
+  if (single &&
+      single->size_x == geom->size_x &&
+      single->size_y == geom->size_y &&
+      single->size_z == geom->size_z)
+    {
+      astern_reset (single);
+      return;
+    }
+
+  destruct_astern ();
+  single = astern_new (geom);
+}
+
+
+void
+destruct_astern (void)
 {
-  int i;
-  for(i=0; i < NUM; i++) {
-     double red=0.0, green=0.0, blue=0.0;  
-     Node_t* n = set[i];
-     if(node_same_pos(n, &start)) {
-	 red=1.0; // Red
-     }
-     else if (node_same_pos(n, &dest)) {
-         red=1.0; // Red
-     }
-     else {
-	switch (n->state) {
-	case Unseen: // Off
-	   red = 0.1;
-	   green = blue = 0.3;
-	   break;
-	case Wall: // Orange
-	   red = 0.9;
-           green = 0.9;
-	   break;
-	case Open: // Green
-	   green = 1.0;
-	   break;
-	case Closed: // Blue
-	   blue = 1.0;
-	   break;
-	}	  
-     }
-     pixel_set (fb, n->x, n->y, n->z, red, green, blue);
-  }			
+  if (single)
+    astern_free (single);
+  single = NULL;
 }
 
-void render_path(double* fb) {
-   Node_t* d;
-   Node_t* n;
-// find dst node
-   d = dst_node();
-   n = d->route_from;
-// follow path backward, colour every node white
-   for(;n != 0 && !node_same_pos(n,&start); n = n->route_from) {
-	pixel_set(fb, n->x, n->y, n->z, 1.0, 1.0,1.0);
-   }
-}	
 
+int
+astern_step (void)
+{
+  return single ? astern_expand (single) : -1;
+}
 
+
+int
+astern_step_to (double t,
+                double steps_per_second,
+                double budget)
+{
+  return single ? astern_advance (single, t, steps_per_second, budget) : -1;
+}
+
+
+void
+render_map (pixel_t            *fb,
+            const CubeGeometry *geom)
+{
+  if (single)
+    astern_render_map (single, fb, geom);
+}
+
+
+void
+render_path (pixel_t            *fb,
+             const CubeGeometry *geom)
+{
+  if (single)
+    astern_render_path (single, fb, geom);
+}
@@ -1,19 +1,122 @@
-#define NUM (8*8*8)
-#define SIZE 8
+#ifndef __RENDERER_ASTERN_H__
+#define __RENDERER_ASTERN_H__
+
+#include <stdint.h>
+
+#include "render-utils.h"
+#include "wall-map.h"
+
+/*
+ * A* search through the cube, from the far corner to the origin, one
+ * node expanded per step.  Nodes are numbered like the pixels of an
+ * xyz framebuffer, so the neighbours of a node are its index plus or
+ * minus the stride of an axis.  The open nodes are in a binary heap on
+ * their estimated total cost, a step is O(log n).  Every search has
+ * its own state, any number of them can run side by side.
+ *
+ * All state lives in one allocation, an array per field: the state of
+ * every node, its path cost, the node it got reached from and its
+ * place in the heap.  astern_reset () starts a new search in place,
+ * in new walls from a WallMap that always leave a route to dest.
+ *
+ * The heuristic estimates the steps left from a node to dest.  As long
+ * as it never overestimates them, the route found is a shortest one.
+ * Steps go along one axis, so the Manhattan distance (the default) is
+ * the closest such estimate.  The straight line distance explores more
+ * nodes, and no estimate at all turns the search into Dijkstra's.
+ *
+ * An animation paces the search by its own clock: astern_advance ()
+ * expands as many nodes as are due at time t, at steps_per_second,
+ * but never spends more than budget seconds of the frame on it.  The
+ * steps that didn't fit are made up in later frames.
+ */
 
 typedef enum {Unseen, Open, Closed, Wall} State;
 
-typedef struct Node {
-	State state;
-	double d; // distance to dest
-	double pc; //
-	int x, y, z;
-	struct Node* route_from;
-	} Node_t;
-
-  
-void init_astern(); 
-void destruct_astern(); 
-int astern_step();
-void render_map(double* fb);
-void render_path(double* fb);
+/* dx, dy and dz are the distances to dest along each axis */
+typedef float (*AsternHeuristic) (int dx,
+                                  int dy,
+                                  int dz);
+
+typedef struct
+{
+  float               f;             /* path cost plus estimate */
+  float               h;             /* estimate */
+  int32_t             node;
+} AsternEntry;
+
+struct _astern
+{
+  int                 size_x, size_y, size_z;
+  int                 n_nodes;
+  int                 start;
+  int                 dest;
+  int                 n_expanded;    /* nodes closed by this search */
+
+  /* private */
+  AsternHeuristic     heuristic;
+  WallMap            *walls;
+  int                 dest_x, dest_y, dest_z;
+  void               *arena;
+  uint8_t            *state;         /* State */
+  int32_t            *cost;          /* steps from start, once seen */
+  int32_t            *parent;        /* where the cheapest route came from */
+  int32_t            *heap_index;    /* place in the heap, while open */
+  AsternEntry        *heap;          /* cheapest first */
+  int                 n_open;
+  int                 result;        /* what astern_expand () returns */
+  double              t_start;       /* of astern_advance (), < 0 unset */
+  double              steps_per_second;
+  int                 n_advanced;    /* steps made by astern_advance () */
+};
+
+typedef struct _astern Astern;
+
+
+Astern * astern_new           (const CubeGeometry *geom);
+void     astern_set_seed      (Astern             *astern,
+                               uint64_t            seed);
+void     astern_set_heuristic (Astern             *astern,
+                               AsternHeuristic     heuristic);
+void     astern_reset         (Astern             *astern);
+int      astern_expand        (Astern             *astern);
+int      astern_expand_budget (Astern             *astern,
+                               int                 max_steps,
+                               double              budget);
+int      astern_advance       (Astern             *astern,
+                               double              t,
+                               double              steps_per_second,
+                               double              budget);
+int      astern_path_length   (Astern             *astern);
+void     astern_render_map    (Astern             *astern,
+                               pixel_t            *fb,
+                               const CubeGeometry *geom);
+void     astern_render_path   (Astern             *astern,
+                               pixel_t            *fb,
+                               const CubeGeometry *geom);
+void     astern_free          (Astern             *astern);
+
+float    astern_manhattan     (int                 dx,
+                               int                 dy,
+                               int                 dz);
+float    astern_euclid        (int                 dx,
+                               int                 dy,
+                               int                 dz);
+float    astern_dijkstra      (int                 dx,
+                               int                 dy,
+                               int                 dz);
+
+/* the same on a single search, for mode_astern and render_astern.
+ * init_astern () only allocates when the geometry changes. */
+void init_astern      (const CubeGeometry *geom);
+void destruct_astern  (void);
+int  astern_step      (void);
+int  astern_step_to   (double              t,
+                       double              steps_per_second,
+                       double              budget);
+void render_map       (pixel_t            *fb,
+                       const CubeGeometry *geom);
+void render_path      (pixel_t            *fb,
+                       const CubeGeometry *geom);
+
+#endif
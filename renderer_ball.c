@@ -38,10 +38,26 @@ double triangle_ramp(double peak, double radius, double var)
 }
 
 void render_ball(double t,
-	double* fb)
+	pixel_t* fb,
+	const CubeGeometry *geom)
+{
+  render_ball_slab(t, fb, geom, 0, geom->size_x);
+}
+
+/* only the x planes x_start .. x_end - 1 */
+void render_ball_slab(double t,
+	pixel_t* fb,
+	const CubeGeometry *geom,
+	int x_start,
+	int x_end)
 {
   int x, y, z;
   double ta = fmod(t, 2*3.1415); // time angle in radians	
+  // distances in 8x8x8 units on every axis, pixel centres spread over
+  // 0 .. 7 like there
+  double scale_x = 8.0 / geom->size_x;
+  double scale_y = 8.0 / geom->size_y;
+  double scale_z = 8.0 / geom->size_z;
   double cx=3.5, cy=3.5, cz=3.5;
   double ar = 3;	
   cx += ar*cos(ta);
@@ -49,13 +65,15 @@ void render_ball(double t,
   cz += ar*cos(fmod(ta+3.14, 2*3.1415));
   
 
-  for (x = 0; x < 8; x++)
+  for (x = x_start; x < x_end; x++)
     {
-      for (y = 0; y < 8; y++)
+      for (y = 0; y < geom->size_y; y++)
         {
-          for (z = 0; z < 8; z++)
+          for (z = 0; z < geom->size_z; z++)
             {
-	      double d = euclid_3d(x - cx, y - cy, z - cz);
+	      double d = euclid_3d((x + 0.5) * scale_x - 0.5 - cx,
+	                           (y + 0.5) * scale_y - 0.5 - cy,
+	                           (z + 0.5) * scale_z - 0.5 - cz);
 	      double td = fmod(t-d, 5.83); // time distance from centre
 	      double red = triangle_ramp(2.33, 2.33, td);
 	      //ramp(7,0,1*2,td) + inv_ramp(3,2*2,3*2,td);
@@ -63,7 +81,7 @@ void render_ball(double t,
 	      //ramp(7,1,2*2,td) + inv_ramp(3,0,1*2,td);
 	      double blue = triangle_ramp(0, 2.33, td);
 	      //ramp(7,2*2,3*2,td) + inv_ramp(3,1*2,2*2,td);
-              pixel_set (fb, x, y, z, red, green, blue);
+              pixel_set (fb, geom, x, y, z, red, green, blue);
             }
         }
     }
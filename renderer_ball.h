@@ -1,3 +1,10 @@
 
 void render_ball(double t,
-	double* fb);
+	pixel_t* fb,
+	const CubeGeometry *geom);
+
+void render_ball_slab(double t,
+	pixel_t* fb,
+	const CubeGeometry *geom,
+	int x_start,
+	int x_end);
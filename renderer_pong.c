@@ -20,20 +20,22 @@ static double g = -9.81 / 2;
 static int state;
 
 void
-render_paddle (double *framebuffer,
-               double  x,
-               double  y,
-               double  z,
-               double  red,
-               double  green,
-               double  blue,
-               double  size)
+render_paddle (pixel_t            *framebuffer,
+               const CubeGeometry *geom,
+               double   x,
+               double   y,
+               double   z,
+               double   red,
+               double   green,
+               double   blue,
+               double   size)
 {
   int ix, iy;
 
-  x *= 4;
-  y *= 4;
-  size *= 4;
+  /* from the 0.0 .. 2.0 blob coordinates to pixels */
+  x *= geom->size_x / 2.0;
+  y *= geom->size_y / 2.0;
+  size *= geom->size_x / 2.0;
 
   ix = (int) (x - size/2);
   iy = (int) (y - size/2);
@@ -46,7 +48,7 @@ render_paddle (double *framebuffer,
               (CLAMP (size - ABS (((double) ix) - x), 0.0, 1.0) *
                CLAMP (size - ABS (((double) iy) - y), 0.0, 1.0));
 
-          render_pixel (framebuffer, ix, iy, ROUND (z),
+          render_pixel (framebuffer, geom, ix, iy, ROUND (z),
                         red, green, blue, alpha);
         }
     }
@@ -54,21 +56,24 @@ render_paddle (double *framebuffer,
 
 
 void render_pong (double  t,
-                  double* fb,
+                  pixel_t* fb,
+                  const CubeGeometry *geom,
                   double  joy_x,
                   double  joy_y)
 {
+  /* center of the outermost pixel, 1.75 for 8x8x8 */
+  const double edge = 2.0 - 2.0 / geom->size_x;
   double dt;
 
-  joy_x = ( joy_x + 1.0) / 2.0 * (1.75 - PADDLE_SIZE) + PADDLE_SIZE / 2;
-  joy_y = (-joy_y + 1.0) / 2.0 * (1.75 - PADDLE_SIZE) + PADDLE_SIZE / 2;
+  joy_x = ( joy_x + 1.0) / 2.0 * (edge - PADDLE_SIZE) + PADDLE_SIZE / 2;
+  joy_y = (-joy_y + 1.0) / 2.0 * (edge - PADDLE_SIZE) + PADDLE_SIZE / 2;
 
   if (!have_init || pz < -10.0)
     {
       have_init = 1;
       dt = 0.0;
-      px = drand48 () * 1.75;
-      py = drand48 () * 1.75;
+      px = drand48 () * edge;
+      py = drand48 () * edge;
       pz = 2.0;
       dx = dy = dz = 0.0;
       last_t = t;
@@ -90,9 +95,9 @@ void render_pong (double  t,
           px = 0.0 - px;
           dx *= -1.0;
         }
-      else if (px > 1.75)
+      else if (px > edge)
         {
-          px = 1.75 - px + 1.75;
+          px = edge - px + edge;
           dx *= -1.0;
         }
 
@@ -101,9 +106,9 @@ void render_pong (double  t,
           py = 0.0 - py;
           dy *= -1.0;
         }
-      else if (py > 1.75)
+      else if (py > edge)
         {
-          py = 1.75 - py + 1.75;
+          py = edge - py + edge;
           dy *= -1.0;
         }
 
@@ -135,15 +140,15 @@ void render_pong (double  t,
         }
     }
 
-  framebuffer_set (fb, 0.05, 0.0, 0.25);
+  framebuffer_set (fb, geom, 0.05, 0.0, 0.25);
 
-  render_blob (fb, px, py, pz, 0.0, 1.0, 1.0, 0.7, 1.5);
+  render_blob (fb, geom, px, py, pz, 0.0, 1.0, 1.0, 0.7, 1.5);
   if (state == 1)
-    render_paddle (fb, joy_x, joy_y, 0, 0.0, 1.0, 0.0, 7);
+    render_paddle (fb, geom, joy_x, joy_y, 0, 0.0, 1.0, 0.0, 7);
   else if (state == 2 || pz < 0.0)
-    render_paddle (fb, joy_x, joy_y, 0, 1.0, 0.3, 0.0, 7);
+    render_paddle (fb, geom, joy_x, joy_y, 0, 1.0, 0.3, 0.0, 7);
 
-  render_paddle (fb, joy_x, joy_y, 0, 1.0, 1.0, 0.0, PADDLE_SIZE);
+  render_paddle (fb, geom, joy_x, joy_y, 0, 1.0, 1.0, 0.0, PADDLE_SIZE);
 
   if (state == 1)
     state = 0;
@@ -1,5 +1,6 @@
 
 void render_pong (double  t,
-                  double* fb,
+                  pixel_t* fb,
+                  const CubeGeometry *geom,
                   double  joy_x,
                   double  joy_y);
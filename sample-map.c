@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "sample-map.h"
+
+
+SampleMap *
+sample_map_new (int n_points)
+{
+  SampleMap *map;
+
+  if (n_points < 1)
+    {
+      fprintf (stderr, "a sample map needs at least one point\n");
+      return NULL;
+    }
+
+  map = calloc (1, sizeof (SampleMap));
+  if (!map)
+    {
+      perror ("sample_map_new");
+      return NULL;
+    }
+
+  map->n_points = n_points;
+  map->points = calloc (n_points * 2, sizeof (double));
+  map->offsets = calloc (n_points * 4, sizeof (int32_t));
+  map->weights = calloc (n_points * 4, sizeof (float));
+
+  if (!map->points || !map->offsets || !map->weights)
+    {
+      perror ("sample_map_new");
+      sample_map_free (map);
+      return NULL;
+    }
+
+  return map;
+}
+
+
+void
+sample_map_set_point (SampleMap *map,
+                      int        index,
+                      double     u,
+                      double     v)
+{
+  if (index < 0 || index >= map->n_points)
+    return;
+
+  map->points[index * 2 + 0] = u;
+  map->points[index * 2 + 1] = v;
+  map->valid = 0;
+}
+
+
+/* the image rows the points read from with this transform, the lower
+ * bilinear neighbours included.  Starts at row 0 at the earliest, rows
+ * past the bottom of the image simply don't get decoded.  n_rows is 0
+ * when no point reaches the image. */
+void
+sample_map_rows (const SampleMap       *map,
+                 const SampleTransform *transform,
+                 int                   *row_start,
+                 int                   *n_rows)
+{
+  double min_y = INFINITY, max_y = -INFINITY;
+  int i;
+
+  for (i = 0; i < map->n_points; i++)
+    {
+      double u = map->points[i * 2 + 0];
+      double v = map->points[i * 2 + 1];
+      double y = transform->yx * u + transform->yy * v + transform->y0;
+
+      /* NaN compares false, sample_map_update () skips those too */
+      if (y < min_y)
+        min_y = y;
+      if (y > max_y)
+        max_y = y;
+    }
+
+  if (!(max_y > -1.0 && min_y < 1e9))
+    {
+      *row_start = 0;
+      *n_rows = 0;
+      return;
+    }
+
+  *row_start = floor (fmax (min_y, 0.0));
+  *n_rows = (int) floor (fmin (max_y, 1e9)) + 2 - *row_start;
+}
+
+
+/* recomputes offsets and weights unless they are still good for this
+ * transform and image layout.  Returns 1 when the map got rebuilt. */
+int
+sample_map_update (SampleMap             *map,
+                   const SampleTransform *transform,
+                   int                    width,
+                   int                    height,
+                   int                    rowstride)
+{
+  int i, j, k;
+
+  if (map->valid &&
+      memcmp (&map->transform, transform, sizeof (SampleTransform)) == 0 &&
+      map->width == width &&
+      map->height == height &&
+      map->rowstride == rowstride)
+    return 0;
+
+  for (i = 0; i < map->n_points; i++)
+    {
+      double u = map->points[i * 2 + 0];
+      double v = map->points[i * 2 + 1];
+      double x, y, dx, dy;
+      int x0, y0;
+
+      x = transform->xx * u + transform->xy * v + transform->x0;
+      y = transform->yx * u + transform->yy * v + transform->y0;
+
+      /* also catches NaN, and keeps floor () within int range */
+      if (!(x > -1.0 && x < width && y > -1.0 && y < height))
+        {
+          memset (map->offsets + i * 4, 0, 4 * sizeof (int32_t));
+          memset (map->weights + i * 4, 0, 4 * sizeof (float));
+          continue;
+        }
+
+      x0 = floor (x);
+      y0 = floor (y);
+      dx = x - x0;
+      dy = y - y0;
+
+      /* neighbours outside of the image get weight 0 and a harmless
+       * offset, the gather loop doesn't have to check anything */
+      for (j = 0; j < 2; j++)
+        {
+          for (k = 0; k < 2; k++)
+            {
+              int xk = x0 + k;
+              int yj = y0 + j;
+              double w = (k ? dx : 1.0 - dx) * (j ? dy : 1.0 - dy);
+
+              if (xk < 0 || xk >= width || yj < 0 || yj >= height)
+                {
+                  map->offsets[i * 4 + j * 2 + k] = 0;
+                  map->weights[i * 4 + j * 2 + k] = 0.0f;
+                }
+              else
+                {
+                  map->offsets[i * 4 + j * 2 + k] = yj * rowstride + xk * 3;
+                  map->weights[i * 4 + j * 2 + k] = w / 255.0;
+                }
+            }
+        }
+    }
+
+  map->transform = *transform;
+  map->width = width;
+  map->height = height;
+  map->rowstride = rowstride;
+  map->valid = 1;
+
+  return 1;
+}
+
+
+/* writes three channels per point to out.  The map has to be up to
+ * date for the layout of pixels, see sample_map_update (). */
+void
+sample_map_apply_u8 (const SampleMap *map,
+                     const uint8_t   *pixels,
+                     pixel_t         *out)
+{
+  const int32_t *offsets = map->offsets;
+  const float *weights = map->weights;
+  int i, c;
+
+  for (i = 0; i < map->n_points; i++)
+    {
+      const int32_t *o = offsets + i * 4;
+      const float *w = weights + i * 4;
+
+      for (c = 0; c < 3; c++)
+        {
+          float value = w[0] * pixels[o[0] + c] +
+                        w[1] * pixels[o[1] + c] +
+                        w[2] * pixels[o[2] + c] +
+                        w[3] * pixels[o[3] + c];
+
+          out[i * 3 + c] = PIXEL_FROM_DOUBLE (value);
+        }
+    }
+}
+
+
+void
+sample_map_free (SampleMap *map)
+{
+  free (map->points);
+  free (map->offsets);
+  free (map->weights);
+  free (map);
+}
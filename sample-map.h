@@ -0,0 +1,69 @@
+#ifndef __SAMPLE_MAP_H__
+#define __SAMPLE_MAP_H__
+
+#include <stdint.h>
+
+#include "pixel-format.h"
+
+/*
+ * Projection of an image onto a fixed set of points, e.g. the LEDs of a
+ * panel.  Every point has a position (u, v), an affine transform maps
+ * these into image coordinates.  For every point the map keeps the
+ * offsets of its four neighbour pixels and their bilinear weights, so
+ * projecting a frame is a plain gather without bounds checks.  The map
+ * only gets rebuilt when the transform or the image layout changes.
+ *
+ * The result is the same as sample_buffer_u8 () at the transformed
+ * positions, pixels outside of the image count as black.
+ * sample_map_rows () tells which image rows a transform reads, only
+ * those need to be decoded.
+ */
+
+typedef struct
+{
+  double xx, xy;
+  double yx, yy;
+  double x0, y0;
+} SampleTransform;
+
+#define SAMPLE_TRANSFORM_IDENTITY { 1.0, 0.0, 0.0, 1.0, 0.0, 0.0 }
+
+struct _sample_map
+{
+  int                 n_points;
+  double             *points;        /* u, v */
+
+  /* what offsets and weights were computed for */
+  int                 valid;
+  SampleTransform     transform;
+  int                 width;
+  int                 height;
+  int                 rowstride;
+
+  int32_t            *offsets;       /* 4 per point, into the image */
+  float              *weights;       /* 4 per point, scaled by 1/255 */
+};
+
+typedef struct _sample_map SampleMap;
+
+
+SampleMap * sample_map_new       (int                    n_points);
+void        sample_map_set_point (SampleMap             *map,
+                                  int                    index,
+                                  double                 u,
+                                  double                 v);
+void        sample_map_rows      (const SampleMap       *map,
+                                  const SampleTransform *transform,
+                                  int                   *row_start,
+                                  int                   *n_rows);
+int         sample_map_update    (SampleMap             *map,
+                                  const SampleTransform *transform,
+                                  int                    width,
+                                  int                    height,
+                                  int                    rowstride);
+void        sample_map_apply_u8  (const SampleMap       *map,
+                                  const uint8_t         *pixels,
+                                  pixel_t               *out);
+void        sample_map_free      (SampleMap             *map);
+
+#endif
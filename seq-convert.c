@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+#include <netinet/in.h>
+
+#include "opc-client.h"
+#include "render-utils.h"
+#include "frame-sequence.h"
+
+/*
+ * Builds a frame sequence from a series of PNG images, one image per
+ * frame.  Image columns map to x and rows to z, top row at the top of
+ * the cube.  An image can hold several slices side by side (-s), they
+ * get spread over the y axis, otherwise every y slice shows the same
+ * picture.  Images get resampled to the cube resolution.
+ */
+
+static void
+usage (const char *name)
+{
+  fprintf (stderr,
+           "usage: %s [-g geometry] [-f fps] [-s slices] output.seq image.png...\n"
+           "  -g  cube geometry, e.g. 8, 16 or 16x16x8:zyx (default 8)\n"
+           "  -f  frames per second (default 20)\n"
+           "  -s  number of y slices side by side in every image (default 1)\n",
+           name);
+  exit (1);
+}
+
+
+static void
+convert_image (const CubeGeometry *geom,
+               int                 n_slices,
+               const uint8_t      *pixels,
+               int                 width,
+               int                 height,
+               int                 rowstride,
+               pixel_t            *fb)
+{
+  double slice_width = (double) width / n_slices;
+  int x, y, z;
+
+  for (y = 0; y < geom->size_y; y++)
+    {
+      int slice = y * n_slices / geom->size_y;
+
+      for (x = 0; x < geom->size_x; x++)
+        {
+          for (z = 0; z < geom->size_z; z++)
+            {
+              double sample[3], px, py;
+
+              /* pixel centers to pixel centers */
+              px = slice * slice_width +
+                   (x + 0.5) * slice_width / geom->size_x - 0.5;
+              py = (geom->size_z - 1 - z + 0.5) * height / geom->size_z - 0.5;
+
+              sample_buffer_u8 (pixels, width, height, rowstride,
+                                px, py, sample);
+              pixel_set (fb, geom, x, y, z, sample[0], sample[1], sample[2]);
+            }
+        }
+    }
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+  CubeGeometry geom = cube_geometry_8;
+  FrameSequenceWriter *writer;
+  double fps = 20.0;
+  int n_slices = 1;
+  pixel_t *fb;
+  uint8_t *frame;
+  int opt, i, n_frames;
+
+  while ((opt = getopt (argc, argv, "g:f:s:")) != -1)
+    {
+      switch (opt)
+        {
+          case 'g':
+            if (!cube_geometry_parse (&geom, optarg))
+              exit (1);
+            break;
+          case 'f':
+            fps = atof (optarg);
+            break;
+          case 's':
+            n_slices = atoi (optarg);
+            break;
+          default:
+            usage (argv[0]);
+        }
+    }
+
+  if (argc - optind < 2 || !(fps > 0.0) || n_slices < 1)
+    usage (argv[0]);
+
+  n_frames = argc - optind - 1;
+
+  writer = frame_sequence_writer_new (argv[optind], &geom, n_frames);
+  if (!writer)
+    exit (1);
+
+  fb = framebuffer_new (&geom);
+  frame = calloc (geom.fb_size, sizeof (uint8_t));
+
+  for (i = 0; i < n_frames; i++)
+    {
+      char *path = argv[optind + 1 + i];
+      int width, height, rowstride;
+      void *pixels;
+
+      if (read_png_rows (path, IMAGE_FORMAT_U8, 0, -1,
+                         &width, &height, &rowstride, &pixels) < 0)
+        {
+          fprintf (stderr, "failed to read %s\n", path);
+          break;
+        }
+
+      convert_image (&geom, n_slices, pixels, width, height, rowstride, fb);
+      free (pixels);
+
+      /* the same conversion the OPC client would do when sending */
+      opc_quantize (frame, fb, geom.fb_size);
+
+      if (!frame_sequence_writer_add (writer, i / fps, frame))
+        break;
+    }
+
+  framebuffer_free (fb);
+  free (frame);
+
+  /* removes the output again unless all frames made it */
+  if (!frame_sequence_writer_finish (writer, n_frames / fps))
+    exit (1);
+
+  printf ("%s: %d frames, %dx%dx%d, %.2f s\n", argv[optind], n_frames,
+          geom.size_x, geom.size_y, geom.size_z, n_frames / fps);
+
+  return 0;
+}
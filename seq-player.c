@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <netinet/in.h>
+
+#include "opc-client.h"
+#include "render-utils.h"
+#include "frame-scheduler.h"
+#include "frame-sequence.h"
+
+#define DEFAULT_FPS 50.0
+
+/*
+ * Plays a frame sequence (see seq-convert) in a loop.  The frames go
+ * straight from the mapped file into the OPC packet, there is no
+ * framebuffer and nothing gets rendered.
+ */
+
+int
+main (int   argc,
+      char *argv[])
+{
+  FrameSequence *seq;
+  FrameScheduler *sched;
+  OpcClient *client;
+
+  if (argc < 2)
+    {
+      fprintf (stderr, "usage: %s file.seq [host:port [fps]]\n", argv[0]);
+      exit (1);
+    }
+
+  seq = frame_sequence_open (argv[1]);
+  if (!seq)
+    exit (1);
+
+  sched = frame_scheduler_new (argc > 3 ? atof (argv[3]) : DEFAULT_FPS);
+  if (!sched)
+    exit (1);
+
+  client = opc_client_new (argc > 2 ? argv[2] : "127.0.0.1:7890", 7890,
+                           seq->frame_size, NULL);
+  if (!client)
+    {
+      fprintf (stderr, "can't open client\n");
+      exit (1);
+    }
+
+  if (seq->frame_size > 0xffff)
+    {
+      int n_slabs = cube_geometry_slabs (&seq->geometry);
+      int slab_size = seq->frame_size / n_slabs;
+      int i;
+
+      for (i = 0; i < n_slabs; i++)
+        opc_client_add_channel (client, i + 1, i * slab_size, slab_size);
+    }
+
+  fprintf (stderr, "%s: %d frames, %dx%dx%d, %.2f s\n",
+           argv[1], seq->n_frames,
+           seq->geometry.size_x, seq->geometry.size_y, seq->geometry.size_z,
+           seq->duration);
+
+  opc_client_connect (client);
+  opc_client_start_async (client);
+
+  while (1)
+    {
+      double t;
+      int index;
+
+      t = frame_scheduler_wait (sched);
+      index = frame_sequence_find (seq, t);
+
+      opc_client_write_raw (client, frame_sequence_frame (seq, index), 0, 0);
+    }
+
+  opc_client_shutdown (client);
+  frame_scheduler_free (sched);
+  frame_sequence_close (seq);
+
+  return 0;
+}
@@ -0,0 +1,352 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "render-utils.h"
+
+#include "wall-map.h"
+
+/* layouts wall_map_generate () tries before it leaves the grid empty */
+#define MAX_TRIES 64
+
+/* the walls of a layout, sizes for an 8 cell grid.  axis is the one a
+ * wall stands across, -1 for a random one. */
+static const struct
+{
+  int height;
+  int width;
+  int axis;
+} layout[] =
+{
+  { 7, 7,  0 },
+  { 3, 4, -1 },
+  { 2, 2, -1 },
+  { 6, 3, -1 },
+  { 4, 5, -1 },
+};
+
+#define N_WALLS (sizeof (layout) / sizeof (layout[0]))
+
+/* the axis across a wall, the one along its height and along its width */
+static const int orientations[6][3] =
+{
+  { 0, 1, 2 },
+  { 1, 2, 0 },
+  { 2, 0, 1 },
+  { 0, 2, 1 },
+  { 1, 0, 2 },
+  { 2, 1, 0 },
+};
+
+
+WallMap *
+wall_map_new (int size_x,
+              int size_y,
+              int size_z)
+{
+  WallMap *map;
+  int n_words;
+
+  map = calloc (1, sizeof (WallMap));
+  if (!map)
+    {
+      perror ("wall_map_new");
+      return NULL;
+    }
+
+  map->size_x = size_x;
+  map->size_y = size_y;
+  map->size_z = size_z;
+  map->slab_words = (size_y * size_z + 63) / 64;
+
+  n_words = size_x * map->slab_words;
+  map->bits = calloc (n_words, sizeof (uint64_t));
+  map->seen = calloc (n_words, sizeof (uint64_t));
+  map->stack = malloc (size_x * size_y * size_z * sizeof (int32_t));
+
+  if (!map->bits || !map->seen || !map->stack)
+    {
+      perror ("wall_map_new");
+      wall_map_free (map);
+      return NULL;
+    }
+
+  wall_map_seed (map, 0);
+
+  return map;
+}
+
+
+void
+wall_map_seed (WallMap  *map,
+               uint64_t  seed)
+{
+  map->rng = seed;
+}
+
+
+/* splitmix64 */
+static uint64_t
+wall_map_next (WallMap *map)
+{
+  uint64_t z = (map->rng += 0x9e3779b97f4a7c15ULL);
+
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+  return z ^ (z >> 31);
+}
+
+
+/* a number from 0 to n - 1 */
+uint32_t
+wall_map_random (WallMap  *map,
+                 uint32_t  n)
+{
+  return ((wall_map_next (map) >> 32) * n) >> 32;
+}
+
+
+void
+wall_map_clear (WallMap *map)
+{
+  memset (map->bits, 0,
+          map->size_x * map->slab_words * sizeof (uint64_t));
+}
+
+
+void
+wall_map_set (WallMap *map,
+              int      x,
+              int      y,
+              int      z,
+              int      wall)
+{
+  int bit = WALL_MAP_BIT (map, x, y, z);
+  uint64_t *word = &map->bits[x * map->slab_words + bit / 64];
+
+  if (wall)
+    *word |= 1ULL << (bit % 64);
+  else
+    *word &= ~(1ULL << (bit % 64));
+}
+
+
+/* sets bits first to last of a slab */
+static void
+set_run (uint64_t *slab,
+         int       first,
+         int       last)
+{
+  while (first <= last)
+    {
+      int offset = first % 64;
+      int n = MIN (64 - offset, last - first + 1);
+      uint64_t mask = n == 64 ? ~0ULL : ((1ULL << n) - 1) << offset;
+
+      slab[first / 64] |= mask;
+      first += n;
+    }
+}
+
+
+/* walls in every cell from x0, y0, z0 to x1, y1, z1, both included,
+ * as far as they are inside the grid */
+void
+wall_map_add_box (WallMap *map,
+                  int      x0,
+                  int      y0,
+                  int      z0,
+                  int      x1,
+                  int      y1,
+                  int      z1)
+{
+  int x, y;
+
+  x0 = MAX (x0, 0);
+  y0 = MAX (y0, 0);
+  z0 = MAX (z0, 0);
+  x1 = MIN (x1, map->size_x - 1);
+  y1 = MIN (y1, map->size_y - 1);
+  z1 = MIN (z1, map->size_z - 1);
+
+  if (z0 > z1)
+    return;
+
+  for (x = x0; x <= x1; x++)
+    {
+      uint64_t *slab = map->bits + x * map->slab_words;
+
+      for (y = y0; y <= y1; y++)
+        set_run (slab,
+                 WALL_MAP_BIT (map, x, y, z0),
+                 WALL_MAP_BIT (map, x, y, z1));
+    }
+}
+
+
+/* marks cell i seen and stacks it, unless it is a wall or seen already */
+static void
+wall_map_visit (WallMap *map,
+                int      i,
+                int     *n_stacked)
+{
+  const int slab_cells = map->size_y * map->size_z;
+  int x = i / slab_cells;
+  int bit = i % slab_cells;
+  int word = x * map->slab_words + bit / 64;
+  uint64_t mask = 1ULL << (bit % 64);
+
+  if ((map->bits[word] | map->seen[word]) & mask)
+    return;
+
+  map->seen[word] |= mask;
+  map->stack[(*n_stacked)++] = i;
+}
+
+
+/* whether a route without walls leads from cell from to cell to, the
+ * cells numbered like the pixels of an xyz framebuffer.  A depth first
+ * search that takes the steps towards to first: it goes straight there
+ * through sparse walls, and still sees every cell it can reach before
+ * it gives up. */
+int
+wall_map_connected (WallMap *map,
+                    int      from,
+                    int      to)
+{
+  const int strides[3] = { map->size_y * map->size_z, map->size_z, 1 };
+  const int sizes[3] = { map->size_x, map->size_y, map->size_z };
+  int target[3], n_stacked = 0;
+
+  memset (map->seen, 0,
+          map->size_x * map->slab_words * sizeof (uint64_t));
+
+  target[0] = to / strides[0];
+  target[1] = to / strides[1] % sizes[1];
+  target[2] = to % sizes[2];
+
+  wall_map_visit (map, from, &n_stacked);
+
+  while (n_stacked > 0)
+    {
+      int i = map->stack[--n_stacked];
+      int pos[3], towards[3], n_towards = 0;
+      int axis;
+
+      if (i == to)
+        return 1;
+
+      pos[0] = i / strides[0];
+      pos[1] = i / strides[1] % sizes[1];
+      pos[2] = i % sizes[2];
+
+      /* the steps away from to go on the stack first, popped last */
+      for (axis = 0; axis < 3; axis++)
+        {
+          if (pos[axis] > 0)
+            {
+              if (target[axis] < pos[axis])
+                towards[n_towards++] = i - strides[axis];
+              else
+                wall_map_visit (map, i - strides[axis], &n_stacked);
+            }
+
+          if (pos[axis] < sizes[axis] - 1)
+            {
+              if (target[axis] > pos[axis])
+                towards[n_towards++] = i + strides[axis];
+              else
+                wall_map_visit (map, i + strides[axis], &n_stacked);
+            }
+        }
+
+      while (n_towards > 0)
+        wall_map_visit (map, towards[--n_towards], &n_stacked);
+    }
+
+  return 0;
+}
+
+
+static void
+wall_map_add_random_wall (WallMap *map,
+                          int      height,
+                          int      width,
+                          int      axis)
+{
+  const int sizes[3] = { map->size_x, map->size_y, map->size_z };
+  const int *orientation;
+  int lo[3], hi[3];
+  int across, along_h, along_w;
+
+  if (axis < 0)
+    orientation = orientations[wall_map_random (map, 6)];
+  else
+    orientation = orientations[axis];
+
+  across = orientation[0];
+  along_h = orientation[1];
+  along_w = orientation[2];
+
+  /* a wall never fills a whole side, and starts past the first cell */
+  height = CLAMP (height, 1, sizes[along_h] - 1);
+  width = CLAMP (width, 1, sizes[along_w] - 1);
+
+  lo[across] = hi[across] = wall_map_random (map, sizes[across]);
+  lo[along_h] = 1 + wall_map_random (map, sizes[along_h] - height);
+  hi[along_h] = lo[along_h] + height - 1;
+  lo[along_w] = 1 + wall_map_random (map, sizes[along_w] - width);
+  hi[along_w] = lo[along_w] + width - 1;
+
+  wall_map_add_box (map, lo[0], lo[1], lo[2], hi[0], hi[1], hi[2]);
+}
+
+
+/* new random walls, with a route from cell from to cell to.  Returns
+ * the number of layouts it took, 0 if none had a route and the grid
+ * was left without walls. */
+int
+wall_map_generate (WallMap *map,
+                   int      from,
+                   int      to)
+{
+  const int slab_cells = map->size_y * map->size_z;
+  int size = MIN (MIN (map->size_x, map->size_y), map->size_z);
+  int try, i;
+
+  for (try = 1; try <= MAX_TRIES; try++)
+    {
+      wall_map_clear (map);
+
+      for (i = 0; i < N_WALLS; i++)
+        wall_map_add_random_wall (map,
+                                  layout[i].height * size / 8,
+                                  layout[i].width * size / 8,
+                                  layout[i].axis);
+
+      wall_map_set (map, from / slab_cells,
+                    from % slab_cells / map->size_z,
+                    from % map->size_z, 0);
+      wall_map_set (map, to / slab_cells,
+                    to % slab_cells / map->size_z,
+                    to % map->size_z, 0);
+
+      if (wall_map_connected (map, from, to))
+        return try;
+    }
+
+  wall_map_clear (map);
+
+  return 0;
+}
+
+
+void
+wall_map_free (WallMap *map)
+{
+  free (map->bits);
+  free (map->seen);
+  free (map->stack);
+  free (map);
+}
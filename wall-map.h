@@ -0,0 +1,70 @@
+#ifndef __WALL_MAP_H__
+#define __WALL_MAP_H__
+
+#include <stdint.h>
+
+/*
+ * Obstacles in a grid of size_x x size_y x size_z cells, one bit per
+ * cell.  Every x plane is a slab of whole 64 bit words, the cells in it
+ * numbered like the pixels of an xyz framebuffer, y * size_z + z.  So a
+ * cell's index in the grid is x * size_y * size_z plus its bit in the
+ * slab, and a box is a run of bits per y row of every slab it covers,
+ * written a word at a time.
+ *
+ * wall_map_generate () places random walls until the two given cells
+ * are connected.  A depth first search over the bits checks that, it
+ * tries the steps towards the target first.
+ * The walls come from the map's own random generator, the same seed
+ * gives the same walls on every run and machine.
+ */
+
+struct _wall_map
+{
+  int                 size_x, size_y, size_z;
+  int                 slab_words;    /* per x plane */
+  uint64_t           *bits;
+
+  /* private */
+  uint64_t            rng;
+  uint64_t           *seen;          /* wall_map_connected () */
+  int32_t            *stack;
+};
+
+typedef struct _wall_map WallMap;
+
+#define WALL_MAP_BIT(map, x, y, z) ((y) * (map)->size_z + (z))
+#define WALL_MAP_GET(map, x, y, z) \
+  (((map)->bits[(x) * (map)->slab_words +                           \
+                WALL_MAP_BIT (map, x, y, z) / 64] >>                \
+    (WALL_MAP_BIT (map, x, y, z) % 64)) & 1)
+
+
+WallMap *wall_map_new       (int       size_x,
+                             int       size_y,
+                             int       size_z);
+void     wall_map_seed      (WallMap  *map,
+                             uint64_t  seed);
+uint32_t wall_map_random    (WallMap  *map,
+                             uint32_t  n);
+void     wall_map_clear     (WallMap  *map);
+void     wall_map_set       (WallMap  *map,
+                             int       x,
+                             int       y,
+                             int       z,
+                             int       wall);
+void     wall_map_add_box   (WallMap  *map,
+                             int       x0,
+                             int       y0,
+                             int       z0,
+                             int       x1,
+                             int       y1,
+                             int       z1);
+int      wall_map_connected (WallMap  *map,
+                             int       from,
+                             int       to);
+int      wall_map_generate  (WallMap  *map,
+                             int       from,
+                             int       to);
+void     wall_map_free      (WallMap  *map);
+
+#endif